@@ -0,0 +1,525 @@
+#define _GNU_SOURCE  // wait4() for the resource usage of the client
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+/* Global constants: requests and responses of the synthetic server */
+#define REQUEST_LIMIT 1024  // Longest request line accepted
+#define CHUNK_SIZE 65536    // Bytes of file content sent at once
+#define STALL_MS 600000     // Time for which a stalled response is held
+#define SLOW_CHUNK 16       // Bytes of a slow response sent at once
+#define SLOW_INTERVAL 100   // Milliseconds between chunks of a slow response
+#define UNREACHABLE_PORT 1  // Port at which no server is expected to listen
+
+/* Global constants: default shape of the synthetic tree */
+#define DEFAULT_DEPTH 3       // Levels of subdirectories below the root
+#define DEFAULT_FANOUT 4      // Subdirectories of every directory
+#define DEFAULT_FILES 8       // Files of every directory
+#define DEFAULT_FILE_SIZE 4096  // Size of the smallest file in bytes
+#define DEFAULT_CLIENT "./client"  // Client benchmarked
+#define USAGE "Usage: %s [--depth N] [--fanout N] [--files N] " \
+              "[--file-size BYTES] [--latency MS] [--errors N] " \
+              "[--externals N] [--stalled N] [--slow N] [--show] " \
+              "[<client> [-- <client options> ...]]\n"
+
+/* Shape of the synthetic tree and behaviour of the server */
+typedef struct tree_config {
+    int depth;      // Levels of subdirectories below the root
+    int fanout;     // Subdirectories of every directory
+    int files;      // Files of every directory, alternately text and binary
+    int file_size;  // Size of the first file of a directory in bytes
+    int latency;    // Milliseconds before every response
+    int errors;     // References of every directory to missing directories
+    int externals;  // References of the root to external servers
+    int stalled;    // Files of the root which are never sent
+    int slow;       // Files of the root which are trickled
+} tree_config;
+
+/* Request and response totals of one phase, from the metrics of the client */
+typedef struct phase_totals {
+    char name[16];               // Name of the phase
+    unsigned long long requests; // Number of requests
+    unsigned long long failures; // Number of failed requests
+    unsigned long long bytes;    // Bytes received
+    long long wall_time_us;      // Time from the first to the last request
+} phase_totals;
+
+/* Functions */
+static void *serve(void *arg);
+static void *serve_request(void *arg);
+static void send_directory(int sock, const char *selector, int level);
+static void send_file(int sock, int size, bool text);
+static void send_slowly(int sock, int size);
+static void send_error(int sock, const char *selector);
+static void send_all(int sock, const char *data, size_t length);
+static void stall(int sock);
+static int parse_directory(const char *selector, const char **rest);
+static long long count_directories(void);
+static int read_metrics(char *path, phase_totals *phases, int capacity);
+static long long monotonic_us(void);
+
+/* Global variables: values used across all functions */
+static tree_config tree = {DEFAULT_DEPTH, DEFAULT_FANOUT, DEFAULT_FILES,
+                           DEFAULT_FILE_SIZE, 0, 1, 2, 0, 0};
+static int server_port = 0;  // Port at which the synthetic server listens
+
+/**
+ * Benchmark the Gopher client against a synthetic Gopher server listening on
+ * the loopback interface, and print the throughput and resource usage of the
+ * crawl.
+ */
+int main(int argc, char *argv[]) {
+    static struct option options[] = {
+        {"depth", required_argument, NULL, 'd'},
+        {"fanout", required_argument, NULL, 'o'},
+        {"files", required_argument, NULL, 'n'},
+        {"file-size", required_argument, NULL, 's'},
+        {"latency", required_argument, NULL, 'l'},
+        {"errors", required_argument, NULL, 'e'},
+        {"externals", required_argument, NULL, 'x'},
+        {"stalled", required_argument, NULL, 'S'},
+        {"slow", required_argument, NULL, 'w'},
+        {"show", no_argument, NULL, 'v'},
+        {NULL, 0, NULL, 0}
+    };
+    int *values[] = {&tree.depth, &tree.fanout, &tree.files, &tree.file_size,
+                     &tree.latency, &tree.errors, &tree.externals,
+                     &tree.stalled, &tree.slow};
+    const char *letters = "donslexSw";
+    bool show = false;
+    int option;
+    while ((option = getopt_long(argc, argv, "+d:o:n:s:l:e:x:S:w:v", options,
+                                 NULL)) != -1) {
+        char *letter = option != 0 ? strchr(letters, option) : NULL;
+        if (letter != NULL && atoi(optarg) >= 0) {
+            *values[letter - letters] = atoi(optarg);
+            continue;
+        }
+        if (option == 'v') {
+            show = true;
+            continue;
+        }
+        fprintf(stderr, USAGE, argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    // The client options follow "--", which getopt_long() skips if the
+    // client is not given
+    char *client = DEFAULT_CLIENT;
+    if (optind < argc && strcmp(argv[optind - 1], "--") != 0) {
+        client = argv[optind++];
+        if (optind < argc && strcmp(argv[optind], "--") == 0) optind++;
+    }
+
+    // Listen at a port chosen by the system on the loopback interface
+    int listener = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int enable = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addr_len = sizeof(addr);
+    if (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) == -1
+            || listen(listener, SOMAXCONN) == -1
+            || getsockname(listener, (struct sockaddr *)&addr, &addr_len)
+                == -1) {
+        fprintf(stderr, "Error: Unable to start the synthetic server\n");
+        exit(EXIT_FAILURE);
+    }
+    server_port = ntohs(addr.sin_port);
+
+    char metrics_path[] = "/tmp/gopher-bench-XXXXXX";
+    int metrics_fd = mkstemp(metrics_path);
+    if (metrics_fd == -1) {
+        fprintf(stderr, "Error: Unable to create the metrics file\n");
+        exit(EXIT_FAILURE);
+    }
+    close(metrics_fd);
+
+    // The client reports quietly to the metrics file, followed by the options
+    // given to the benchmark and the address of the synthetic server
+    char port[16];
+    snprintf(port, sizeof(port), "%d", server_port);
+    char **args = calloc(argc - optind + 7, sizeof(char *));
+    int n = 0;
+    args[n++] = client;
+    args[n++] = "--quiet";
+    args[n++] = "--metrics-json";
+    args[n++] = metrics_path;
+    for (int i = optind; i < argc; i++) args[n++] = argv[i];
+    args[n++] = "127.0.0.1";
+    args[n++] = port;
+
+    long long started = monotonic_us();
+    pid_t pid = fork();
+    if (pid == -1) {
+        fprintf(stderr, "Error: Unable to start the client\n");
+        exit(EXIT_FAILURE);
+    }
+    if (pid == 0) {
+        if (!show) {
+            int null = open("/dev/null", O_WRONLY);
+            dup2(null, STDOUT_FILENO);
+        }
+        execv(client, args);
+        fprintf(stderr, "Error: Unable to run %s\n", client);
+        _exit(127);
+    }
+
+    // The server only starts once the client is forked, which therefore
+    // does not inherit its threads
+    pthread_t server;
+    pthread_create(&server, NULL, serve, &listener);
+    pthread_detach(server);
+
+    int status;
+    struct rusage usage;
+    while (wait4(pid, &status, 0, &usage) == -1 && errno == EINTR);
+    double elapsed = (monotonic_us() - started) / 1e6;
+    free(args);
+
+    phase_totals phases[8];
+    int num_of_phases = read_metrics(metrics_path, phases, 8);
+    unlink(metrics_path);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "Error: The client failed (status %d)\n",
+                WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+        exit(EXIT_FAILURE);
+    }
+    if (num_of_phases == 0) {
+        fprintf(stderr, "Error: No metrics written by the client\n");
+        exit(EXIT_FAILURE);
+    }
+
+    long long directories = count_directories();
+    printf("Synthetic tree: %lld directories, %lld files, %lld invalid "
+           "references, %d external references\n", directories,
+           directories * tree.files + tree.stalled + tree.slow,
+           directories * tree.errors, tree.externals);
+    printf("(depth %d, fan-out %d, %d-byte files, %d ms latency)\n\n",
+           tree.depth, tree.fanout, tree.file_size, tree.latency);
+
+    unsigned long long requests = 0;
+    unsigned long long bytes = 0;
+    for (int i = 0; i < num_of_phases; i++) {
+        requests += phases[i].requests;
+        bytes += phases[i].bytes;
+    }
+    printf("Wall time: %.3f s\n", elapsed);
+    printf("Selectors: %llu (%.1f selectors/s)\n", requests,
+           requests / elapsed);
+    printf("Bytes: %llu (%.3f MB/s)\n", bytes, bytes / elapsed / 1e6);
+    printf("Peak RSS: %ld KiB\n\n", usage.ru_maxrss);
+
+    printf("%-10s %10s %10s %12s %12s\n", "Phase", "Requests", "Failures",
+           "Bytes", "Wall time");
+    for (int i = 0; i < num_of_phases; i++) {
+        printf("%-10s %10llu %10llu %12llu %10.3f s\n", phases[i].name,
+               phases[i].requests, phases[i].failures, phases[i].bytes,
+               phases[i].wall_time_us / 1e6);
+    }
+
+    close(listener);
+    return 0;
+}
+
+/**
+ * Accept connections to the synthetic server, answering each of them in a
+ * thread of its own so that slow and stalled responses hold up nothing else.
+ *
+ * @param arg pointer to the listening socket
+ * @return NULL once the socket is closed
+ */
+static void *serve(void *arg) {
+    int listener = *(int *)arg;
+    for (;;) {
+        int sock = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+        if (sock == -1) {
+            if (errno == EINTR || errno == ECONNABORTED || errno == EMFILE)
+                continue;
+            return NULL;
+        }
+        pthread_t thread;
+        int *client = malloc(sizeof(int));
+        *client = sock;
+        if (pthread_create(&thread, NULL, serve_request, client) != 0) {
+            close(sock);
+            free(client);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+}
+
+/**
+ * Read a request line and answer with the directory index, the file or the
+ * error it refers to in the synthetic tree.
+ *
+ * Directories are named "/d<i>" under their parent, files "f<k>.txt" (even k)
+ * or "f<k>.bin" (odd k), and the stalled and slow files of the root
+ * "/stall<k>.txt" and "/slow<k>.txt". Anything else is missing.
+ *
+ * @param arg pointer to the socket connected to the client
+ * @return NULL
+ */
+static void *serve_request(void *arg) {
+    int sock = *(int *)arg;
+    free(arg);
+
+    char request[REQUEST_LIMIT + 1];
+    size_t length = 0;
+    char *end = NULL;
+    while (end == NULL && length < REQUEST_LIMIT) {
+        ssize_t bytes = recv(sock, request + length, REQUEST_LIMIT - length,
+                             0);
+        if (bytes <= 0) break;
+        length += bytes;
+        request[length] = '\0';
+        end = strstr(request, "\r\n");
+    }
+    if (end == NULL) {
+        close(sock);
+        return NULL;
+    }
+    *end = '\0';
+
+    if (tree.latency > 0) {
+        struct timespec delay = {tree.latency / 1000,
+                                 (tree.latency % 1000) * 1000000L};
+        nanosleep(&delay, NULL);
+    }
+
+    const char *rest;
+    int level = parse_directory(request, &rest);
+    int k;
+    char extension[5];
+    int consumed = 0;
+    if (level >= 0 && *rest == '\0')
+        send_directory(sock, request, level);
+    else if (level >= 0
+            && sscanf(rest, "/f%d.%4s%n", &k, extension, &consumed) == 2
+            && rest[consumed] == '\0' && k >= 0 && k < tree.files
+            && strcmp(extension, k % 2 == 0 ? "txt" : "bin") == 0)
+        send_file(sock, tree.file_size + k, k % 2 == 0);
+    else if (sscanf(request, "/stall%d.txt%n", &k, &consumed) == 1
+            && request[consumed] == '\0' && k >= 0 && k < tree.stalled)
+        stall(sock);
+    else if (sscanf(request, "/slow%d.txt%n", &k, &consumed) == 1
+            && request[consumed] == '\0' && k >= 0 && k < tree.slow)
+        send_slowly(sock, tree.file_size);
+    else
+        send_error(sock, request);
+
+    close(sock);
+    return NULL;
+}
+
+/**
+ * Send the directory index of a directory of the synthetic tree.
+ *
+ * @param sock socket connected to the client
+ * @param selector selector of the directory, empty for the root
+ * @param level number of directories above it
+ */
+static void send_directory(int sock, const char *selector, int level) {
+    char *menu = NULL;
+    size_t length = 0;
+    FILE *out = open_memstream(&menu, &length);
+    fprintf(out, "iSynthetic directory %s\tfake\tfake\t0\r\n",
+            level == 0 ? "/" : selector);
+    if (level < tree.depth) {
+        for (int i = 0; i < tree.fanout; i++)
+            fprintf(out, "1Directory %d\t%s/d%d\t127.0.0.1\t%d\r\n", i,
+                    selector, i, server_port);
+    }
+    for (int k = 0; k < tree.files; k++)
+        fprintf(out, "%cFile %d\t%s/f%d.%s\t127.0.0.1\t%d\r\n",
+                k % 2 == 0 ? '0' : '9', k, selector, k,
+                k % 2 == 0 ? "txt" : "bin", server_port);
+    for (int e = 0; e < tree.errors; e++)
+        fprintf(out, "1Missing %d\t%s/missing%d\t127.0.0.1\t%d\r\n", e,
+                selector, e, server_port);
+    if (level == 0) {
+        for (int k = 0; k < tree.stalled; k++)
+            fprintf(out, "0Stalled %d\t/stall%d.txt\t127.0.0.1\t%d\r\n", k,
+                    k, server_port);
+        for (int k = 0; k < tree.slow; k++)
+            fprintf(out, "0Slow %d\t/slow%d.txt\t127.0.0.1\t%d\r\n", k, k,
+                    server_port);
+        // Only the first external server is reachable, being this one
+        for (int x = 0; x < tree.externals; x++)
+            fprintf(out, "1External %d\t\t127.0.0.1\t%d\r\n", x,
+                    x == 0 ? server_port : UNREACHABLE_PORT + x - 1);
+    }
+    fprintf(out, ".\r\n");
+    fclose(out);
+    send_all(sock, menu, length);
+    free(menu);
+}
+
+/**
+ * Send the content of a file of the synthetic tree.
+ *
+ * @param sock socket connected to the client
+ * @param size size of the file in bytes
+ * @param text whether the file is a text file, terminated by ".\r\n"
+ */
+static void send_file(int sock, int size, bool text) {
+    static char chunk[CHUNK_SIZE];
+    if (chunk[0] == '\0') memset(chunk, 'x', sizeof(chunk));
+    if (text && size >= 3) size -= 3;
+    while (size > 0) {
+        int length = size < CHUNK_SIZE ? size : CHUNK_SIZE;
+        send_all(sock, chunk, length);
+        size -= length;
+    }
+    if (text) send_all(sock, ".\r\n", 3);
+}
+
+/**
+ * Trickle the content of a file to exceed the transfer deadline of the
+ * client, giving up once the client disconnects.
+ *
+ * @param sock socket connected to the client
+ * @param size size of the file in bytes
+ */
+static void send_slowly(int sock, int size) {
+    char chunk[SLOW_CHUNK];
+    memset(chunk, 'x', sizeof(chunk));
+    for (; size > 0; size -= SLOW_CHUNK) {
+        if (send(sock, chunk, size < SLOW_CHUNK ? size : SLOW_CHUNK,
+                 MSG_NOSIGNAL) <= 0)
+            return;
+        struct pollfd fd = {sock, POLLIN, 0};
+        if (poll(&fd, 1, SLOW_INTERVAL) != 0) return;
+    }
+}
+
+/**
+ * Send the error of a missing item, as Motsognir does.
+ *
+ * @param sock socket connected to the client
+ * @param selector selector requested
+ */
+static void send_error(int sock, const char *selector) {
+    char line[REQUEST_LIMIT + 64];
+    int length = snprintf(line, sizeof(line),
+                          "3'%s' does not exist\terror.host\t1\r\n.\r\n",
+                          selector);
+    send_all(sock, line, length);
+}
+
+/**
+ * Send all the bytes given, unless the client disconnects.
+ *
+ * @param sock socket connected to the client
+ * @param data pointer to the bytes
+ * @param length number of bytes
+ */
+static void send_all(int sock, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t bytes = send(sock, data, length, MSG_NOSIGNAL);
+        if (bytes <= 0) return;
+        data += bytes;
+        length -= bytes;
+    }
+}
+
+/**
+ * Hold a response back until the client gives up and disconnects.
+ *
+ * @param sock socket connected to the client
+ */
+static void stall(int sock) {
+    struct pollfd fd = {sock, POLLIN, 0};
+    poll(&fd, 1, STALL_MS);
+}
+
+/**
+ * Find the directory of the synthetic tree which a selector begins with.
+ *
+ * @param selector selector requested
+ * @param rest the rest of the selector after the directory (output)
+ * @return number of directories above that directory, -1 if the selector
+ *         does not begin with one
+ */
+static int parse_directory(const char *selector, const char **rest) {
+    int level = 0;
+    const char *c = selector;
+    while (c[0] == '/' && c[1] == 'd' && level < tree.depth) {
+        char *end;
+        long i = strtol(c + 2, &end, 10);
+        if (end == c + 2 || i < 0 || i >= tree.fanout
+                || (*end != '/' && *end != '\0'))
+            break;
+        c = end;
+        level++;
+    }
+    if (c != selector && *c != '\0' && *c != '/') return -1;
+    *rest = c;
+    return level;
+}
+
+/**
+ * Count the directories of the synthetic tree, including the root.
+ *
+ * @return number of directories
+ */
+static long long count_directories(void) {
+    long long directories = 0;
+    long long level = 1;
+    for (int d = 0; d <= tree.depth; d++) {
+        directories += level;
+        level *= tree.fanout;
+    }
+    return directories;
+}
+
+/**
+ * Read the totals of every phase from the metrics written by the client.
+ *
+ * @param path metrics file in JSON
+ * @param phases totals of the phases (output)
+ * @param capacity number of phases which can be read
+ * @return number of phases read
+ */
+static int read_metrics(char *path, phase_totals *phases, int capacity) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) return 0;
+    char line[4096];
+    int count = 0;
+    while (count < capacity && fgets(line, sizeof(line), file) != NULL) {
+        phase_totals *p = &phases[count];
+        if (sscanf(line, " \"%15[^\"]\": {\"requests\": %llu, \"failures\": "
+                         "%llu, \"bytes\": %llu, \"wall_time_us\": %lld",
+                   p->name, &p->requests, &p->failures, &p->bytes,
+                   &p->wall_time_us) == 5)
+            count++;
+    }
+    fclose(file);
+    return count;
+}
+
+/**
+ * Read the monotonic clock in microseconds.
+ *
+ * @return current time in microseconds
+ */
+static long long monotonic_us(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
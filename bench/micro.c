@@ -0,0 +1,566 @@
+/* The static functions of the indexer are benchmarked where they are
+   defined, so the library is compiled into the benchmark */
+#include "../gopherindex.c"
+#include <getopt.h>
+
+/* Global constants: workloads of the microbenchmarks */
+#define DEFAULT_LINES 1000000  // Lines of the synthetic directory index
+#define MIN_BYTES 67108864     // Bytes processed by a benchmark at least
+#define MIN_RUNS 3             // Runs of a benchmark at least
+#define DEFAULT_ASSETS {"assets/output1.txt", "assets/output2.txt", \
+                        "assets/output3.txt"}
+#define MICRO_USAGE "Usage: %s [--lines N] [<menu or client output> ...]\n"
+
+/* Directory index benchmarked, with its lines split once for the benchmarks
+   which start from split lines */
+typedef struct workload {
+    char *name;           // Name printed with the results
+    char *menu;           // Directory index as received from a server
+    size_t bytes;         // Length of the directory index
+    char *split;          // Copy of the directory index split into lines
+    menu_line *lines;     // Fields of every line
+    size_t num_of_lines;  // Number of lines
+    char **records;       // Records of the distinct items indexed
+    int *types;           // Types of the distinct items indexed
+    size_t num_of_items;  // Number of distinct items indexed
+} workload;
+
+/* Time taken by the fastest run of a benchmark */
+typedef struct measurement {
+    long long ns;                 // Nanoseconds
+    unsigned long long cycles;    // Time-stamp counter cycles, 0 if unknown
+} measurement;
+
+/* Functions */
+static void run_workload(workload *w);
+static void prepare_workload(workload *w);
+static void release_workload(workload *w);
+static bool load_menu(char *path, FILE *out);
+static void synthesise_menu(size_t num_of_lines, FILE *out);
+static void reset_store(void);
+static void report(char *name, measurement m, size_t entries, size_t bytes);
+static measurement bench_tokenizer(workload *w);
+static measurement bench_classify(workload *w);
+static measurement bench_index_line(workload *w, bool duplicate);
+static measurement bench_add_item(workload *w);
+static measurement bench_store_item(workload *w);
+static measurement bench_intern_string(workload *w);
+static measurement bench_hash_bytes(workload *w);
+static measurement bench_content_hash(workload *w);
+static int count_runs(workload *w);
+static unsigned long long read_cycles(void);
+static long long monotonic_ns(void);
+
+/* Global variables: state shared by the benchmarks */
+static server_state bench_server;  // Server whose entry store is filled
+static volatile size_t sink;       // Results kept from being optimised away
+
+/**
+ * Benchmark the tokenizer, classification and bookkeeping of the client over
+ * directory indices recorded from real servers and a synthetic index.
+ */
+int main(int argc, char *argv[]) {
+    static struct option options[] = {
+        {"lines", required_argument, NULL, 'n'},
+        {NULL, 0, NULL, 0}
+    };
+    size_t num_of_lines = DEFAULT_LINES;
+    int option;
+    while ((option = getopt_long(argc, argv, "n:", options, NULL)) != -1) {
+        if (option == 'n' && atoll(optarg) > 0) {
+            num_of_lines = (size_t)atoll(optarg);
+            continue;
+        }
+        fprintf(stderr, MICRO_USAGE, argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    // The entry store is that of a quiet crawl without checkpoints or output
+    gopher_options quiet;
+    gopher_default_options(&quiet);
+    quiet.verbosity = LOG_FATAL;
+    gopher_context *ctx = gopher_create(&quiet, NULL, NULL);
+    enter_context(ctx);
+    bench_server.checkpoint.fd = -1;
+    bench_server.output.fd = -1;
+    bench_server.smallest.item = ROOT;
+    current = &bench_server;
+
+    // Recorded directory indices, or those reconstructed from client output
+    char *defaults[] = DEFAULT_ASSETS;
+    char **paths = optind < argc ? argv + optind : defaults;
+    int num_of_paths = optind < argc ? argc - optind : 3;
+    workload recorded = {.name = "recorded"};
+    FILE *out = open_memstream(&recorded.menu, &recorded.bytes);
+    bool loaded = false;
+    for (int i = 0; i < num_of_paths; i++) loaded |= load_menu(paths[i], out);
+    fprintf(out, ".\r\n");
+    fclose(out);
+    if (loaded) run_workload(&recorded);
+    else free(recorded.menu);
+
+    workload synthetic = {.name = "synthetic"};
+    out = open_memstream(&synthetic.menu, &synthetic.bytes);
+    synthesise_menu(num_of_lines, out);
+    fclose(out);
+    run_workload(&synthetic);
+    gopher_destroy(ctx);
+
+    return 0;
+}
+
+/**
+ * Run every benchmark over one directory index and print the results.
+ *
+ * @param w directory index benchmarked
+ */
+static void run_workload(workload *w) {
+    prepare_workload(w);
+    printf("Workload: %s (%zu lines, %zu items, %zu bytes)\n", w->name,
+           w->num_of_lines, w->num_of_items, w->bytes);
+    printf("%-28s %12s %12s %12s\n", "Benchmark", "ns/entry", "cycles/entry",
+           "cycles/byte");
+
+    // Every tokenizer which the CPU supports is compared
+    uint32_t (*selected)(const char *, size_t) = delimiter_mask;
+    delimiter_mask = delimiter_mask_scalar;
+    report("find_next_line (scalar)", bench_tokenizer(w), w->num_of_lines,
+           w->bytes);
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("sse2")) {
+        delimiter_mask = delimiter_mask_sse2;
+        report("find_next_line (SSE2)", bench_tokenizer(w), w->num_of_lines,
+               w->bytes);
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        delimiter_mask = delimiter_mask_avx2;
+        report("find_next_line (AVX2)", bench_tokenizer(w), w->num_of_lines,
+               w->bytes);
+    }
+#endif
+    delimiter_mask = selected;
+
+    report("item_classes lookup", bench_classify(w), w->num_of_lines,
+           w->bytes);
+    report("index_line (new items)", bench_index_line(w, false),
+           w->num_of_lines, w->bytes);
+    report("index_line (duplicates)", bench_index_line(w, true),
+           w->num_of_lines, w->bytes);
+    report("add_item", bench_add_item(w), w->num_of_items, w->bytes);
+    report("store_item", bench_store_item(w), w->num_of_items, w->bytes);
+    report("intern_string (duplicates)", bench_intern_string(w),
+           w->num_of_items, w->bytes);
+    report("hash_bytes (FNV-1a)", bench_hash_bytes(w), w->num_of_lines,
+           w->bytes);
+    report("content_update (XXH64)", bench_content_hash(w), w->num_of_lines,
+           w->bytes);
+    printf("\n");
+
+    release_workload(w);
+}
+
+/**
+ * Split the lines of a directory index once, and gather the distinct items
+ * which it lists in the order indexed.
+ *
+ * @param w directory index benchmarked
+ */
+static void prepare_workload(workload *w) {
+    w->split = malloc(w->bytes + 1);
+    memcpy(w->split, w->menu, w->bytes);
+    size_t capacity = 1024;
+    w->lines = malloc(capacity * sizeof(menu_line));
+    char *ptr = w->split;
+    char *end = w->split + w->bytes;
+    menu_line line;
+    while ((ptr = find_next_line(ptr, end, &line)) != NULL) {
+        if (w->num_of_lines == capacity) {
+            capacity *= 2;
+            w->lines = realloc(w->lines, capacity * sizeof(menu_line));
+        }
+        w->lines[w->num_of_lines++] = line;
+    }
+
+    reset_store();
+    for (size_t i = 0; i < w->num_of_lines; i++) index_line(&w->lines[i], "");
+    entry_store *store = &current->store;
+    w->num_of_items = store->count - 1;
+    w->records = malloc(w->num_of_items * sizeof(char *));
+    w->types = malloc(w->num_of_items * sizeof(int));
+    for (size_t i = 0; i < w->num_of_items; i++) {
+        w->records[i] = strdup(store->records[ROOT + 1 + i]);
+        w->types[i] = store->types[ROOT + 1 + i];
+    }
+}
+
+/**
+ * Free the memory of a directory index and the entry store filled from it.
+ *
+ * @param w directory index benchmarked
+ */
+static void release_workload(workload *w) {
+    cleanup();
+    memset(&current->items, 0, sizeof(current->items));
+    memset(&current->strings, 0, sizeof(current->strings));
+    free(current->queue.items);
+    free(current->files.items);
+    memset(&current->queue, 0, sizeof(current->queue));
+    memset(&current->files, 0, sizeof(current->files));
+    for (size_t i = 0; i < w->num_of_items; i++) free(w->records[i]);
+    free(w->records);
+    free(w->types);
+    free(w->lines);
+    free(w->split);
+    free(w->menu);
+}
+
+/**
+ * Append a recorded directory index to a workload. A file without "\r\n" is
+ * taken as the terminal output of the client, and the directory index is
+ * reconstructed from the items it reports as indexed.
+ *
+ * @param path pathname of the file
+ * @param out stream of the workload
+ * @return whether the file could be read
+ */
+static bool load_menu(char *path, FILE *out) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "Error: Unable to read %s\n", path);
+        return false;
+    }
+    char *content = NULL;
+    size_t length = 0;
+    FILE *copy = open_memstream(&content, &length);
+    char chunk[BUFFER_SIZE];
+    size_t bytes;
+    while ((bytes = fread(chunk, 1, sizeof(chunk), file)) > 0)
+        fwrite(chunk, 1, bytes, copy);
+    fclose(copy);
+    fclose(file);
+
+    if (memmem(content, length, "\r\n", 2) != NULL) {
+        // Leave out the terminating ".\r\n" of a recorded directory index
+        if (length >= 3 && memcmp(content + length - 3, ".\r\n", 3) == 0)
+            length -= 3;
+        fwrite(content, 1, length, out);
+        free(content);
+        return true;
+    }
+
+    char *kinds[] = {"Indexed directory: ", "Indexed text file: ",
+                     "Indexed binary file: ", "Indexed external server: "};
+    char types[] = {'1', '0', '9', '1'};
+    for (char *line = strtok(content, "\n"); line != NULL;
+            line = strtok(NULL, "\n")) {
+        for (int k = 0; k < 4; k++) {
+            size_t prefix = strlen(kinds[k]);
+            if (strncmp(line, kinds[k], prefix) != 0) continue;
+            char *record = line + prefix;
+            if (k == 3)
+                fprintf(out, "1External server\t\t%s\r\n", record);
+            else
+                fprintf(out, "%c%s\t%s\texample.org\t70\r\n", types[k],
+                        record, record);
+        }
+    }
+    free(content);
+    return true;
+}
+
+/**
+ * Generate a directory index with a mix of directories, text files, binary
+ * files, informational messages and errors resembling a large real index.
+ *
+ * @param num_of_lines number of lines
+ * @param out stream of the workload
+ */
+static void synthesise_menu(size_t num_of_lines, FILE *out) {
+    char binary[] = {'9', 'I', 'g', 'P'};
+    for (size_t i = 0; i < num_of_lines; i++) {
+        size_t directory = i / 100;
+        if (i % 20 == 0)
+            fprintf(out, "iDirectory %zu of the synthetic index\tfake\tfake"
+                         "\t0\r\n", directory);
+        else if (i % 50 == 1)
+            fprintf(out, "3'/missing/%zu' does not exist\terror.host\t1\r\n",
+                    i);
+        else if (i % 10 == 2)
+            fprintf(out, "1Directory %zu\t/data/dir%zu/sub%zu\texample.org"
+                         "\t70\r\n", i, directory, i);
+        else if (i % 2 == 0)
+            fprintf(out, "0Notes on item %zu\t/data/dir%zu/notes%zu.txt"
+                         "\texample.org\t70\r\n", i, directory, i);
+        else
+            fprintf(out, "%cAttachment %zu\t/data/dir%zu/attachment%zu.bin"
+                         "\texample.org\t70\r\n", binary[i % 4], i,
+                    directory, i);
+    }
+    fprintf(out, ".\r\n");
+}
+
+/**
+ * Empty the entry store, its hash set, the string pool and the queues, and
+ * index the root directory as a crawl does.
+ */
+static void reset_store(void) {
+    cleanup();
+    memset(&current->items, 0, sizeof(current->items));
+    memset(&current->strings, 0, sizeof(current->strings));
+    current->queue.head = current->queue.tail = 0;
+    current->files.head = current->files.tail = 0;
+    store_item(DIRECTORY, "", SIZE_PENDING);
+}
+
+/**
+ * Print the time per entry and the cycles per entry and per byte of the
+ * directory index.
+ *
+ * @param name name of the benchmark
+ * @param m time of the fastest run
+ * @param entries number of entries processed by a run
+ * @param bytes number of bytes of the directory index
+ */
+static void report(char *name, measurement m, size_t entries, size_t bytes) {
+    if (entries == 0) entries = 1;
+    if (m.cycles == 0) {
+        printf("%-28s %12.2f %12s %12s\n", name, (double)m.ns / entries,
+               "-", "-");
+        return;
+    }
+    printf("%-28s %12.2f %12.1f %12.3f\n", name, (double)m.ns / entries,
+           (double)m.cycles / entries, (double)m.cycles / bytes);
+}
+
+/* Start and stop the clocks around a run, keeping the fastest run */
+#define RUN_START() \
+    long long ns_ = monotonic_ns(); \
+    unsigned long long cycles_ = read_cycles();
+#define RUN_STOP(best) \
+    cycles_ = read_cycles() - cycles_; \
+    ns_ = monotonic_ns() - ns_; \
+    if (best.ns == 0 || ns_ < best.ns) { \
+        best.ns = ns_; \
+        best.cycles = cycles_; \
+    }
+
+/**
+ * Split a directory index into lines and fields with find_next_line(),
+ * using the tokenizer currently selected.
+ *
+ * @param w directory index benchmarked
+ * @return time of the fastest run
+ */
+static measurement bench_tokenizer(workload *w) {
+    measurement best = {0, 0};
+    char *work = malloc(w->bytes + 1);
+    for (int run = count_runs(w); run > 0; run--) {
+        // The delimiters are overwritten, so every run starts from a copy
+        memcpy(work, w->menu, w->bytes);
+        char *ptr = work;
+        char *end = work + w->bytes;
+        size_t lines = 0;
+        menu_line line;
+        RUN_START();
+        while ((ptr = find_next_line(ptr, end, &line)) != NULL) lines++;
+        RUN_STOP(best);
+        sink = lines;
+    }
+    free(work);
+    return best;
+}
+
+/**
+ * Look up the item type of every line, as index_line() does.
+ *
+ * @param w directory index benchmarked
+ * @return time of the fastest run
+ */
+static measurement bench_classify(workload *w) {
+    measurement best = {0, 0};
+    char *types = malloc(w->num_of_lines + 1);
+    for (size_t i = 0; i < w->num_of_lines; i++) types[i] = w->lines[i].type;
+    const int *class_types = context->class_types;
+    for (int run = count_runs(w); run > 0; run--) {
+        size_t indexed = 0;
+        RUN_START();
+        for (size_t i = 0; i < w->num_of_lines; i++)
+            indexed += class_types[item_classes[(unsigned char)types[i]]]
+                       != NOT_INDEXED;
+        RUN_STOP(best);
+        sink = indexed;
+    }
+    free(types);
+    return best;
+}
+
+/**
+ * Index every line of a directory index with index_line(), either into an
+ * empty entry store or into one which already holds every item.
+ *
+ * @param w directory index benchmarked
+ * @param duplicate whether the items are already indexed
+ * @return time of the fastest run
+ */
+static measurement bench_index_line(workload *w, bool duplicate) {
+    measurement best = {0, 0};
+    if (duplicate) {
+        reset_store();
+        for (size_t i = 0; i < w->num_of_lines; i++)
+            index_line(&w->lines[i], "");
+    }
+    for (int run = count_runs(w); run > 0; run--) {
+        if (!duplicate) reset_store();
+        RUN_START();
+        for (size_t i = 0; i < w->num_of_lines; i++)
+            index_line(&w->lines[i], "");
+        RUN_STOP(best);
+        sink = current->store.count;
+    }
+    return best;
+}
+
+/**
+ * Add every distinct item of a directory index with add_item(), which stores,
+ * hashes, logs and queues the item.
+ *
+ * @param w directory index benchmarked
+ * @return time of the fastest run
+ */
+static measurement bench_add_item(workload *w) {
+    measurement best = {0, 0};
+    for (int run = count_runs(w); run > 0; run--) {
+        reset_store();
+        RUN_START();
+        for (size_t i = 0; i < w->num_of_items; i++)
+            add_item(w->types[i], w->records[i], SIZE_PENDING);
+        RUN_STOP(best);
+        sink = current->store.count;
+    }
+    return best;
+}
+
+/**
+ * Store every distinct item of a directory index with store_item(), which
+ * takes the place of allocating an entry and interns the record.
+ *
+ * @param w directory index benchmarked
+ * @return time of the fastest run
+ */
+static measurement bench_store_item(workload *w) {
+    measurement best = {0, 0};
+    for (int run = count_runs(w); run > 0; run--) {
+        reset_store();
+        RUN_START();
+        for (size_t i = 0; i < w->num_of_items; i++)
+            store_item(w->types[i], w->records[i], SIZE_PENDING);
+        RUN_STOP(best);
+        sink = current->store.count;
+    }
+    return best;
+}
+
+/**
+ * Look up the record of every distinct item in the string pool, each of
+ * which is already held.
+ *
+ * @param w directory index benchmarked
+ * @return time of the fastest run
+ */
+static measurement bench_intern_string(workload *w) {
+    measurement best = {0, 0};
+    reset_store();
+    for (size_t i = 0; i < w->num_of_items; i++) intern_string(w->records[i]);
+    for (int run = count_runs(w); run > 0; run--) {
+        size_t found = 0;
+        RUN_START();
+        for (size_t i = 0; i < w->num_of_items; i++)
+            found += intern_string(w->records[i]) != NULL;
+        RUN_STOP(best);
+        sink = found;
+    }
+    return best;
+}
+
+/**
+ * Hash the directory index with FNV-1a in pieces of BUFFER_SIZE bytes, as
+ * connection_handle() does for the on-disk index.
+ *
+ * @param w directory index benchmarked
+ * @return time of the fastest run
+ */
+static measurement bench_hash_bytes(workload *w) {
+    measurement best = {0, 0};
+    for (int run = count_runs(w); run > 0; run--) {
+        uint64_t hash = FNV_OFFSET;
+        RUN_START();
+        for (size_t offset = 0; offset < w->bytes; offset += BUFFER_SIZE) {
+            size_t length = w->bytes - offset < BUFFER_SIZE
+                            ? w->bytes - offset : BUFFER_SIZE;
+            hash = hash_bytes(hash, w->menu + offset, length);
+        }
+        RUN_STOP(best);
+        sink = hash;
+    }
+    return best;
+}
+
+/**
+ * Hash the directory index with XXH64 in pieces of BUFFER_SIZE bytes, as
+ * connection_handle() does for the content of files.
+ *
+ * @param w directory index benchmarked
+ * @return time of the fastest run
+ */
+static measurement bench_content_hash(workload *w) {
+    measurement best = {0, 0};
+    for (int run = count_runs(w); run > 0; run--) {
+        content_hash h;
+        RUN_START();
+        content_start(&h);
+        for (size_t offset = 0; offset < w->bytes; offset += BUFFER_SIZE) {
+            size_t length = w->bytes - offset < BUFFER_SIZE
+                            ? w->bytes - offset : BUFFER_SIZE;
+            content_update(&h, w->menu + offset, length);
+        }
+        RUN_STOP(best);
+        sink = content_digest(&h);
+    }
+    return best;
+}
+
+/**
+ * Decide how many times to run a benchmark, so that small directory indices
+ * are processed often enough to be timed reliably.
+ *
+ * @param w directory index benchmarked
+ * @return number of runs
+ */
+static int count_runs(workload *w) {
+    size_t runs = MIN_BYTES / (w->bytes + 1);
+    return runs < MIN_RUNS ? MIN_RUNS : (int)runs;
+}
+
+/**
+ * Read the time-stamp counter of the CPU, where there is one.
+ *
+ * @return number of cycles counted, 0 if unknown
+ */
+static unsigned long long read_cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+/**
+ * Read the monotonic clock in nanoseconds.
+ *
+ * @return current time in nanoseconds
+ */
+static long long monotonic_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000000 + now.tv_nsec;
+}
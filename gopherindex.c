@@ -0,0 +1,5632 @@
+#define _GNU_SOURCE  // getaddrinfo_a() for resolving hostnames in parallel
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "gopherindex.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+/* Global constant: buffer size and limit for receiving server content */
+#define BUFFER_SIZE 65536  // String buffer size
+#define FILE_LIMIT 131072  // Default size limit for downloading files
+#define SIZE_RCVBUF 262144 // Receive buffer of connections measuring files
+#define ARENA_BLOCK 65536  // Size of each block of the storage arena
+#define CACHE_LIMIT 65536  // Default size limit for caching text files
+#define DELIMITER_BLOCK 32 // Bytes of a line scanned for delimiters at once
+#define ISSUES_LISTING "issues.txt"  // Listing of references with issues
+
+/* Global constants: file types and error types */
+#define DIRECTORY 0  // Directory
+#define TEXT 1       // Text (non-binary) file
+#define BINARY 2     // Binary file
+#define ERROR 3      // Error message
+#define EXTERNAL 4   // Reference to external server
+#define TIMEOUT 5    // Access timeout
+#define TOO_LARGE 6  // File size is too large
+#define SEARCH 7     // Full-text search server, if included
+#define LINK 8       // URL link, if included
+#define CONNECT_FAILED 9  // Connection failed, even after retries
+#define NUM_OF_TYPES 10 // Number of item types
+#define NOT_INDEXED -1  // Entries of a directory index which are not indexed
+#define ROOT 0          // Position of the root directory in the entry store
+
+/* Global constants: classes of the type characters of directory entries */
+#define CLASS_IGNORED 0    // End of response or type without a meaning
+#define CLASS_DIRECTORY 1  // Directory ('1')
+#define CLASS_TEXT 2       // Text file ('0')
+#define CLASS_BINARY 3     // Binary file ('9', and specific types like 'I')
+#define CLASS_ERROR 4      // Error message ('3')
+#define CLASS_SEARCH 5     // Full-text search server ('7')
+#define CLASS_HYPERTEXT 6  // HTML file, or URL link if the selector is "URL:"
+#define CLASS_TELNET 7     // Telnet/TN3270 session ('8'/'T')
+#define CLASS_NAMESERVER 8 // CSO phone-book server ('2')
+#define CLASS_MIRROR 9     // Redundant server of the previous entry ('+')
+#define CLASS_INFO 10      // Informational message ('i')
+#define NUM_OF_CLASSES 11  // Number of classes of type characters
+
+/* Global constants: configuration of the crawl engine */
+#define DEFAULT_CONCURRENCY 16  // Default number of concurrent connections
+#define MAX_EVENTS 64           // Events handled by each epoll_wait() call
+
+/* Global constants: phases of execution measured by the request metrics */
+#define PHASE_CRAWL GOPHER_PHASE_CRAWL        // Fetching directory indices
+#define PHASE_SIZE GOPHER_PHASE_SIZE          // Evaluating file sizes
+#define PHASE_EXTERNAL GOPHER_PHASE_EXTERNAL  // Testing external servers
+#define NUM_OF_PHASES GOPHER_NUM_OF_PHASES    // Number of phases
+#define LATENCY_BUCKETS 40  // Power-of-two buckets of microseconds
+
+/* Global constants: deadlines of a request, configurable for every phase */
+#define DEADLINE_CONNECT GOPHER_DEADLINE_CONNECT  // Establishing the connection
+#define DEADLINE_FIRST_BYTE GOPHER_DEADLINE_FIRST_BYTE  // First byte, once sent
+#define DEADLINE_IDLE GOPHER_DEADLINE_IDLE  // Every following packet
+#define DEADLINE_TRANSFER GOPHER_DEADLINE_TRANSFER  // Rest after the first byte
+#define NUM_OF_DEADLINES GOPHER_NUM_OF_DEADLINES  // Number of deadlines
+#define NO_DEADLINE -1         // Request which never expires
+#define UNSCHEDULED SIZE_MAX   // Connection absent from the deadline heap
+
+/* Global constants: verbosity levels and buffering of the logger */
+#define LOG_FATAL GOPHER_LOG_FATAL  // Errors ending a crawl, always logged
+#define LOG_ERROR GOPHER_LOG_ERROR  // Issues with requests and responses
+#define LOG_INFO GOPHER_LOG_INFO    // Requests sent and items indexed
+#define LOG_DEBUG GOPHER_LOG_DEBUG  // Completion and timing of every request
+#define LOG_BUFFER 1048576  // Size of the ring buffer of pending messages
+#define LOG_LINE 512        // Size of the stack buffer formatting a message
+
+/* Global constants: configuration of the resolver cache */
+#define DNS_TIMEOUT 5000     // Milliseconds allowed for resolving hostnames
+#define DNS_TTL 300000       // Milliseconds for which addresses are reused
+#define DNS_NEGATIVE_TTL 30000  // Milliseconds for which failures are reused
+#define DNS_RECHECK 1000     // Milliseconds before a refresh is checked again
+
+/* Global constants: racing the addresses of a hostname (happy eyeballs) */
+#define RACE_DELAY 250      // Milliseconds before the next address is raced
+#define RACE_CANDIDATES 8   // Addresses of a hostname raced at most
+#define RACE_BACKOFF 30000  // Milliseconds before a failed race is run again
+
+/* Global constants: states of a connection handled by the crawl engine */
+#define CONN_IDLE 0        // Slot available for a new request
+#define CONN_CONNECTING 1  // Non-blocking connect() in progress
+#define CONN_SENDING 2     // Request line being written to the socket
+#define CONN_RECEIVING 3   // Response being read from the socket
+#define CONN_RACING 4      // Addresses of the server raced to connect
+
+/* Global constants: requests made by the crawl engine */
+#define JOB_INDEX 0  // Fetch and index a directory
+#define JOB_SIZE 1   // Evaluate the size of a text/binary file
+#define JOB_NONE -1  // Nothing left to request
+
+/* Global constants: orders in which the frontier is crawled */
+#define ORDER_BREADTH GOPHER_ORDER_BREADTH  // Directories first, as found
+#define ORDER_DEPTH GOPHER_ORDER_DEPTH      // Directory found last first
+#define ORDER_FILES GOPHER_ORDER_FILES      // Files ahead of directories
+
+/* Global constants: outcomes of evaluating the size of a file */
+#define SIZE_TOO_LARGE -1  // File size exceeds the file limit
+#define SIZE_FAILED -2     // File could not be received in full
+#define SIZE_PENDING -3    // File size not evaluated yet
+#define SIZE_SKIPPED -4    // File not measured within the budget/limits
+
+/* Global constants: on-disk index of a previous crawl */
+#define INDEX_MAGIC "GOPHIDX2"        // Identifier of the file format
+#define FNV_OFFSET 0xcbf29ce484222325ULL  // Offset basis of 64-bit FNV-1a
+
+/* Global constants: 64-bit XXH64 hash of the content of files */
+#define PRIME64_1 0x9e3779b185ebca87ULL  // Primes of the XXH64 algorithm
+#define PRIME64_2 0xc2b2ae3d27d4eb4fULL
+#define PRIME64_3 0x165667b19e3779f9ULL
+#define PRIME64_4 0x85ebca77c2b2ae63ULL
+#define PRIME64_5 0x27d4eb2f165667c5ULL
+#define HASH_STRIPE 32                   // Bytes taken by the 4 lanes at once
+
+/* Global constants: append-only checkpoint log of a crawl */
+#define CHECKPOINT_MAGIC "GOPHCKP1"  // Identifier of the file format
+#define CHECKPOINT_INTERVAL 1000     // Time (ms) between writes of the log
+#define CHECKPOINT_ITEM 0            // Item indexed
+#define CHECKPOINT_DONE 1            // Directory index fetched
+#define CHECKPOINT_SIZE 2            // File size evaluated
+#define CHECKPOINT_SERVER 3          // Server crawled, the first record
+#define CHECKPOINT_HASH 4            // Content of a file hashed
+
+/* Global constants: machine-readable output of the entries of the index */
+#define OUTPUT_MAGIC "GOPHOUT1"  // Identifier of the binary format
+#define OUTPUT_BUFFER 1048576    // Bytes of entries written out at once
+#define OUTPUT_JSONL GOPHER_OUTPUT_JSONL    // One JSON object per line
+#define OUTPUT_BINARY GOPHER_OUTPUT_BINARY  // Length-prefixed binary records
+#define OUTPUT_OK 0              // Fetched in full
+#define OUTPUT_FAILED 1          // Connection or transfer failed
+#define OUTPUT_TIMEOUT 2         // Server failed to answer in time
+#define OUTPUT_TOO_LARGE 3       // File exceeds the file limit
+#define OUTPUT_INVALID 4         // Invalid reference
+#define OUTPUT_REUSED 5          // Known from a previous crawl or checkpoint
+#define OUTPUT_INDEXED 6         // Listed, but not requested
+#define OUTPUT_UP 7              // External server accepting connections
+#define OUTPUT_DOWN 8            // External server not accepting connections
+#define OUTPUT_SELF 9            // External reference to the server crawled
+#define OUTPUT_SKIPPED 10        // Not requested within the budget/limits
+
+/* Global constants: retries of requests whose connection failed */
+#define DEFAULT_RETRIES 3   // Retries of a request before it fails for good
+#define RETRY_DELAY 500     // Milliseconds before the first retry, doubled
+                            // for every following one
+
+/* Global constants: servers crawled at once */
+#define DEFAULT_THREADS 4  // Default number of servers crawled at once
+
+/* Global constants: politeness of the crawl towards each server */
+#define INITIAL_WINDOW 4   // Requests in flight to a server at first
+#define MIN_WINDOW 1       // Fewest requests in flight after timeouts
+
+/* Positions of all indexed items of one type, in the order indexed */
+typedef struct type_index {
+    size_t *items;    // Positions of the items in the entry store
+    size_t count;     // Number of items of the type
+    size_t capacity;  // Number of positions the array can hold
+} type_index;
+
+/* Structure-of-arrays store of all indexed items in the order indexed, where
+ * an item is identified by its position. The root directory is item ROOT: it
+ * is requested like any directory but never reported. */
+typedef struct entry_store {
+    unsigned char *types;  // Type of every item (directory, file, error, etc.)
+    char **records;        // Pathname, error message or external server
+    ssize_t *sizes;        // Size of a text/binary file, negative if unknown
+    uint64_t *hashes;      // Hash of a directory index or file, 0 if none
+    int64_t *checked;      // Unix time at which the item was last fetched
+    uint32_t *depths;      // Directories between the item and the root
+    size_t count;          // Number of items, including the root
+    size_t capacity;       // Number of items the arrays can hold
+    type_index by_type[NUM_OF_TYPES];  // Items of every type except the root
+} entry_store;
+
+/* Fields of a line in a directory index, split by find_next_line() */
+typedef struct menu_line {
+    char type;       // Item type, the first character of the line
+    char *display;   // Display string (user-visible name)
+    char *selector;  // Selector (pathname), NULL if the line has no tab
+    char *host;      // Hostname of the server, NULL if missing
+    char *port;      // Port of the server, NULL if missing
+} menu_line;
+
+/* Bytes of a file kept in memory after its size is evaluated */
+typedef struct file_cache {
+    char *data;       // Content of the file
+    size_t length;    // Number of bytes cached
+    size_t item;      // File whose entire content is cached, ROOT if none
+} file_cache;
+
+/* Smallest and largest files, updated as the size of every file is known */
+typedef struct size_summary {
+    size_t smallest_text;    // Smallest text file, ROOT if none
+    size_t largest_text;     // Largest text file, ROOT if none
+    size_t smallest_binary;  // Smallest binary file, ROOT if none
+    size_t largest_binary;   // Largest binary file, ROOT if none
+} size_summary;
+
+/* Addresses of a hostname held by the resolver cache */
+typedef struct dns_record {
+    char *hostname;             // Hostname resolved
+    struct addrinfo *addresses; // IPv4/IPv6 addresses, NULL if unresolved
+    long long expires;          // Monotonic time (ms) of the next resolution
+    unsigned int generation;    // Number of times addresses were resolved
+    bool pending;               // Whether a lookup is in progress
+    struct gaicb lookup;        // Asynchronous resolution of the hostname
+    struct addrinfo hints;      // Criteria of the resolution
+} dns_record;
+
+/* Resolver cache of all hostnames resolved during execution */
+typedef struct dns_cache {
+    dns_record **records;  // Records, never moved while lookups are pending
+    size_t count;          // Number of records
+    size_t capacity;       // Number of records the array can hold
+} dns_cache;
+
+/* Monotonic timestamps (in microseconds) and outcome of a request */
+typedef struct request_timing {
+    long long started;     // Connection initiated
+    long long connected;   // Connection established, 0 if not yet
+    long long first_byte;  // First byte of the response received, or 0
+    size_t bytes;          // Number of bytes received
+    bool failed;           // Whether the request timed out or failed
+} request_timing;
+
+/* Distribution of a latency over power-of-two buckets of microseconds */
+typedef struct histogram {
+    uint64_t buckets[LATENCY_BUCKETS];  // Bucket i holds [2^(i-1), 2^i)
+    uint64_t count;  // Number of values recorded
+    uint64_t sum;    // Sum of the values
+    uint64_t max;    // Largest value
+} histogram;
+
+/* Aggregated metrics of all requests made in a phase of execution */
+typedef struct phase_metrics {
+    histogram connect;     // Time taken to establish the connection
+    histogram first_byte;  // Time from the connection to the first byte
+    histogram total;       // Time from initiation to termination
+    uint64_t requests;     // Number of requests made
+    uint64_t failures;     // Number of requests timed out or failed
+    uint64_t bytes;        // Number of bytes received
+    long long start;       // Earliest initiation of a request (us)
+    long long end;         // Latest termination of a request (us)
+} phase_metrics;
+
+/* Connection attempts racing the addresses of a server as in the happy
+ * eyeballs algorithm (RFC 8305): the next address is attempted once the
+ * previous attempt fails or after RACE_DELAY, and the first connection
+ * established wins. */
+typedef struct address_race {
+    struct sockaddr_storage addrs[RACE_CANDIDATES];  // Addresses in order
+    socklen_t lengths[RACE_CANDIDATES];  // Length of every address
+    int fds[RACE_CANDIDATES];  // Socket of every attempt, -1 if over
+    int count;                 // Number of addresses
+    int started;               // Number of attempts started
+    int winner;                // Attempt established, -1 if none yet
+    long long next;            // Monotonic time (ms) of the next attempt
+} address_race;
+
+/* Connectivity test of an external server referenced in the index */
+typedef struct external_probe {
+    char *hostname;         // Hostname of the external server
+    char *port;             // Port of the external server
+    size_t target;          // Probe of the first entry with the same host:port
+    address_race race;      // Connection attempts to its addresses
+    bool up;                // Whether the server accepted the connection
+    bool self;              // Whether it is the server being indexed
+    request_timing timing;  // Timestamps for the request metrics
+} external_probe;
+
+/* Messages waiting to be written by the background writer of the logger. Each
+ * message is stored as a byte selecting the stream followed by its text and a
+ * terminating null byte, possibly wrapping around the end of the buffer. */
+typedef struct log_ring {
+    char data[LOG_BUFFER];   // Storage of the messages
+    size_t head;             // Total number of bytes ever appended
+    size_t tail;             // Total number of bytes ever written out
+    size_t flushed;          // Total number of bytes ever output
+    bool writing;            // Whether the writer is emptying a batch
+    bool running;            // Whether the background writer is started
+    bool stopping;           // Whether the writer has to exit once drained
+    int crawls;              // Crawls running with the writer
+    pthread_t writer;        // Background writer thread
+    pthread_mutex_t lock;    // Protection of the fields above
+    pthread_cond_t ready;    // Signalled when messages are appended
+    pthread_cond_t drained;  // Signalled when messages are written out
+} log_ring;
+
+/* Block of memory from which entries and records are bump-allocated */
+typedef struct arena_block {
+    struct arena_block *next;  // Previously filled block
+    size_t used;               // Number of bytes allocated from the block
+    size_t capacity;           // Number of bytes available in the block
+    char data[];               // Storage of the block
+} arena_block;
+
+/* Open-addressing hash set of interned record strings */
+typedef struct string_pool {
+    char **slots;     // Linear-probing table, NULL marks an empty slot
+    size_t count;     // Number of strings in the pool
+    size_t capacity;  // Number of slots, always a power of two
+} string_pool;
+
+/* Open-addressing hash set of indexed items keyed on (item_type, record) */
+typedef struct item_set {
+    size_t *slots;    // Linear-probing table of positions in the entry
+                      // store; ROOT is never in the set so 0 marks an empty
+                      // slot
+    size_t count;     // Number of items in the set
+    size_t capacity;  // Number of slots, always a power of two
+} item_set;
+
+/* Transfer of a file stopped at the file limit, kept to report a lower bound
+ * of its size and the rate at which it arrived */
+typedef struct file_sample {
+    size_t item;         // Reference of the file as an item too large
+    int64_t bytes;       // Bytes received, a lower bound of the size
+    long long duration;  // Microseconds from the first byte to the last
+} file_sample;
+
+/* Samples of the files too large, in the order of their items too large */
+typedef struct sample_log {
+    file_sample *samples;  // Samples in the order of the items
+    size_t count;          // Number of samples
+    size_t capacity;       // Number of samples the array can hold
+} sample_log;
+
+/* Header of the on-disk index, which is followed by the record array, the
+ * link array and the string table. All integers are in host byte order. */
+typedef struct index_header {
+    char magic[8];           // INDEX_MAGIC
+    uint32_t num_of_records; // Number of records
+    uint32_t num_of_links;   // Number of links from directories to children
+    uint64_t strings_size;   // Size of the string table in bytes
+    int64_t created;         // Unix time at which the index was written
+} index_header;
+
+/* Fixed-size record of an indexed item in the on-disk index */
+typedef struct index_record {
+    uint64_t hash;          // Hash of the directory index or file, 0 if none
+    int64_t size;           // Size of a text/binary file, or SIZE_*
+    int64_t checked;        // Unix time at which the item was last fetched
+    uint32_t record;        // Offset of the record in the string table
+    uint32_t item_type;     // Type of the item
+    uint32_t first_link;    // Position of the first child in the link array
+    uint32_t num_of_links;  // Number of items listed by the directory
+} index_record;
+
+/* On-disk index of a previous crawl, mapped into memory */
+typedef struct saved_index {
+    char *map;               // Mapping of the whole file, NULL if none
+    size_t map_size;         // Size of the mapping
+    index_header *header;    // Header of the index
+    index_record *records;   // Record array
+    uint32_t *links;         // Children of every directory, in menu order
+    char *strings;           // String table
+    uint32_t *slots;         // Hash table of record positions plus one
+    size_t capacity;         // Number of slots (a power of 2)
+} saved_index;
+
+/* Item listed by a directory index, kept for writing the on-disk index */
+typedef struct child_link {
+    size_t parent;  // Directory listing the item
+    size_t child;   // Item listed
+} child_link;
+
+/* Items listed by all directory indices in the order received */
+typedef struct link_log {
+    child_link *links;  // Links in the order received
+    size_t count;       // Number of links
+    size_t capacity;    // Number of links the array can hold
+} link_log;
+
+/* Header of a checkpoint log record, followed by the record string. The log
+ * starts with CHECKPOINT_MAGIC and a record naming the server crawled. */
+typedef struct checkpoint_record {
+    uint8_t kind;       // CHECKPOINT_ITEM, CHECKPOINT_DONE, etc.
+    uint8_t item_type;  // Type of the item
+    uint16_t reserved;  // Padding, always 0
+    uint32_t length;    // Length of the record string
+    int64_t value;      // Size of a file, or time at which it was fetched
+} checkpoint_record;
+
+/* Header of a record of the binary output, followed by the selector and the
+ * hostname without null terminators. The output starts with OUTPUT_MAGIC. */
+typedef struct output_record {
+    uint8_t item_type;         // Type of the entry
+    uint8_t status;            // OUTPUT_OK, OUTPUT_FAILED, etc.
+    uint16_t port;             // Port of the server of the entry
+    uint16_t selector_length;  // Length of the selector
+    uint16_t host_length;      // Length of the hostname
+    int64_t size;              // Size in bytes, -1 if unknown
+    int64_t latency_us;        // Time taken by the request, -1 if not made
+} output_record;
+
+/* Entries of the index waiting to be written to the output */
+typedef struct output_writer {
+    int fd;          // File descriptor of the output, -1 if not written
+    char *data;      // Entries not written yet, OUTPUT_BUFFER bytes
+    size_t length;   // Number of bytes not written yet
+} output_writer;
+
+/* Checkpoint log records waiting to be appended to the file */
+typedef struct checkpoint_log {
+    int fd;              // File descriptor of the log, -1 if not logging
+    char *data;          // Records not written yet
+    size_t length;       // Number of bytes not written yet
+    size_t capacity;     // Number of bytes the buffer can hold
+    long long next;      // Monotonic time (ms) of the next write
+} checkpoint_log;
+
+/* Token bucket limiting the rate of requests to a server, and the window of
+ * requests in flight, grown additively as requests succeed and halved when
+ * one times out (AIMD) */
+typedef struct rate_limiter {
+    double tokens;          // Requests which may be started right away
+    long long refilled;     // Monotonic time (ms) the bucket was refilled
+    double window;          // Requests allowed in flight at once
+    int peak;               // Largest window reached
+    int reductions;         // Number of times the window was halved
+    long long reduced;      // Monotonic time (us) of the last reduction
+} rate_limiter;
+
+/* Binary min-heap of the connections in flight, ordered by deadline */
+typedef struct deadline_heap {
+    struct connection **conns;  // Connections, the earliest deadline first
+    size_t count;               // Number of connections scheduled
+} deadline_heap;
+
+/* XXH64 hash of the content of a file whose bytes arrive in pieces of any
+ * length. Whole stripes are mixed into four independent lanes, so that the
+ * multiplications of the lanes overlap in the pipeline of the CPU. */
+typedef struct content_hash {
+    uint64_t lanes[4];                // Accumulators of the four lanes
+    unsigned char tail[HASH_STRIPE];  // Bytes short of a whole stripe
+    size_t tail_length;               // Number of bytes in the tail
+    uint64_t length;                  // Number of bytes hashed so far
+} content_hash;
+
+/* State machine of a non-blocking request made by the crawl engine */
+typedef struct connection {
+    int fd;                 // Socket file descriptor
+    int state;              // Stage of the request (connecting, sending, etc.)
+    int job;                // Directory indexing or file size evaluation
+    size_t item;            // Directory/file requested
+    int attempts;           // Retries of the request made before this one
+    char *request;          // Request line including the trailing "\r\n"
+    size_t request_length;  // Length of the request line
+    size_t sent;            // Number of bytes of the request line sent
+    char *buffer;           // Partial line carried between recv() calls
+    size_t length;          // Number of bytes of the partial line
+    size_t received;        // Number of bytes received so far
+    bool overflow;          // Whether the partial line exceeds the buffer
+    bool timed_out;         // Whether the deadline of the request passed
+    char *cache;            // Content of a text file, up to cache_limit bytes
+    size_t cached;          // Number of bytes in the cache
+    long long deadline;     // Monotonic time (ms) at which the request expires
+    size_t slot;            // Position in the deadline heap, if scheduled
+    long long since;        // Monotonic time (ms) the current stage started
+    request_timing timing;  // Timestamps for the request metrics
+    uint64_t hash;          // Hash of the directory index received so far
+    content_hash content;   // Hash of the file received so far, if hashed
+    index_record *saved;    // Record of the directory in the previous crawl
+    uint32_t matched;       // Items listed as in the previous crawl so far
+} connection;
+
+/* Request waiting to be retried after its connection failed */
+typedef struct retry_entry {
+    size_t item;     // Directory/file to be requested again
+    int job;         // Directory indexing or file size evaluation
+    int attempts;    // Retries made so far, including this one
+    long long due;   // Monotonic time (ms) at which to retry
+} retry_entry;
+
+/* Min-heap of the requests waiting to be retried, the earliest due first */
+typedef struct retry_queue {
+    retry_entry *entries;  // Requests, the earliest due first
+    size_t count;          // Number of requests waiting
+    size_t capacity;       // Number of requests the array can hold
+} retry_queue;
+
+/* FIFO queue of items waiting to be requested (e.g. the BFS frontier) */
+typedef struct frontier {
+    size_t *items;    // Directories/files in the queue
+    size_t head;      // Index of the next item to be requested
+    size_t tail;      // Index following the last item queued
+    size_t capacity;  // Number of pathnames the array can hold
+} frontier;
+
+/* State of the crawl of one Gopher server, owned by the worker thread which
+ * crawls it. Every function of the crawl refers to it through `current`. */
+typedef struct server_state {
+    char *hostname;                 // Hostname/IP address of the server
+    int port;                       // Port of the Gopher server
+    int hop;                        // External references followed to it
+    struct sockaddr_storage addr;   // Address and port information
+    socklen_t addr_len;             // Length of the address, 0 if none
+    address_race candidates;        // Addresses of its hostname, in order
+    unsigned int generation;        // Resolution of the candidates, 0 if none
+    long long candidates_expire;    // Time (ms) they are checked in the cache
+    address_race race;              // Race to its addresses, if running
+    connection *racer;              // Connection running the race, or NULL
+    long long rerace;               // Time (ms) a failed race may run again
+    entry_store store;              // All items in the order indexed
+    frontier queue;                 // Directories to be indexed
+    frontier files;                 // Files to be measured
+    retry_queue retries;            // Requests to be retried
+    unsigned int jitter;            // State of the jitter of the retries
+    item_set items;                 // Index of the entry store
+    arena_block *arena;             // Storage of records
+    string_pool strings;            // Interned record strings
+    file_cache smallest;            // Smallest text file so far
+    size_summary summary;           // Smallest and largest files so far
+    sample_log samples;             // Files stopped at the file limit
+    size_t skipped;                 // Files not measured within the budget
+    size_t unvisited;               // Directories not crawled within limits
+    size_t parent;                  // Directory whose items are indexed
+    size_t requests;                // Requests started by the crawl engine
+    long long stop;                 // Time (ms) to stop, or NO_DEADLINE
+    char *listing_path;             // Directory of the listings, or NULL
+    FILE *listings[NUM_OF_TYPES];   // Listing of every type streamed, or NULL
+    phase_metrics metrics[NUM_OF_PHASES];  // Metrics of the requests
+    char *index_path;               // On-disk index of the crawl, or NULL
+    saved_index last_crawl;         // Index of the previous crawl
+    link_log links;                 // Children of every directory
+    char *checkpoint_path;          // Checkpoint log of the crawl, or NULL
+    checkpoint_log checkpoint;      // Progress of the crawl
+    char *output_path;              // Machine-readable output, or NULL
+    output_writer output;           // Entries waiting to be written
+    rate_limiter limiter;           // Politeness of the requests to it
+    deadline_heap timers;           // Deadlines of the requests in flight
+    bool restoring;                 // Whether the checkpoint is being replayed
+    bool unreachable;               // Whether a connection to it has failed
+    bool failed;                    // Whether its crawl stopped on an error
+    FILE *report;                   // Stream of the report of evaluate()
+    char *report_data;              // Report held until all crawls complete
+    size_t report_size;             // Length of the report
+    size_t totals[NUM_OF_TYPES];    // Number of items of every type
+} server_state;
+
+/* Servers to be crawled, extended by the external references followed */
+typedef struct server_list {
+    server_state **servers;  // States of the servers, never moved
+    size_t count;            // Number of servers
+    size_t capacity;         // Number of servers the array can hold
+} server_list;
+
+/* Crawl of one or more servers, sharing no state with other contexts except
+ * the logger and the socket features detected */
+struct gopher_context {
+    gopher_options options;            // Options of the crawl
+    int class_types[NUM_OF_CLASSES];   // Item type indexed for every class
+    uint64_t index_seed;               // Hash basis of directory indices
+    bool multi_server;                 // Whether several servers are crawled
+    server_list servers;               // All servers, in report order
+    size_t next_server;                // Next server to be crawled
+    int busy_workers;                  // Workers crawling a server
+    pthread_mutex_t servers_lock;      // Protection of the fields above
+    pthread_cond_t servers_changed;    // Signalled when servers are added
+    dns_cache resolver;                // Addresses of all hostnames
+    pthread_mutex_t resolver_lock;     // Protection of the resolver cache
+    gopher_callback callback;          // Receiver of the entries, or NULL
+    void *user_data;                   // Argument given to the callback
+    pthread_mutex_t callback_lock;     // One entry delivered at a time
+    atomic_llong budget;               // Bytes of files left for all servers
+};
+
+/* Helper functions */
+static gopher_context *enter_context(gopher_context *ctx);
+static bool add_server(const char *hostname, int port, int hop);
+static void *crawl_worker(void *arg);
+static void crawl_server(server_state *server);
+static char *server_path(const char *path);
+static void release_servers(void);
+static ssize_t gopher_connect(ssize_t (*func)(int, char *), char *request);
+static int server_connect(int phase, int flags, int rcvbuf, char *request,
+                          size_t length, size_t *sent);
+static int server_socket(int flags, int rcvbuf, char *request,
+                         size_t length, size_t *sent);
+static void server_unreachable(void);
+static void server_failed(void);
+static void memory_failed(void);
+static void race_prepare(address_race *race, struct addrinfo *list, int port);
+static void race_add(address_race *race, struct addrinfo *addr, int port);
+static int race_attempt(address_race *race, int rcvbuf);
+static bool race_check(address_race *race, int attempt);
+static bool race_pending(address_race *race);
+static int race_connect(address_race *race, int rcvbuf, long long deadline);
+static void race_finish(address_race *race);
+static void race_start(connection *conn, int epoll_fd);
+static void race_advance(connection *conn, int epoll_fd);
+static void race_abandon(connection *conn);
+static void crawl(void);
+static bool take_token(long long now);
+static long long next_token(void);
+static void grow_window(void);
+static void shrink_window(request_timing *timing);
+static long long request_deadline(int phase, int stage, long long since,
+                                  long long first_byte);
+static void schedule_deadline(connection *conn);
+static void cancel_deadline(connection *conn);
+static void sift_deadline(size_t slot);
+static void swap_deadlines(size_t a, size_t b);
+static bool wait_socket(int sock, short events, long long deadline);
+static void connection_open(connection *conn, int job, size_t item,
+                            int attempts, int epoll_fd);
+static void connection_handle(connection *conn, int epoll_fd);
+static void connection_failed(connection *conn);
+static bool retry_request(connection *conn);
+static void retry_push(retry_queue *q, retry_entry entry);
+static retry_entry retry_pop(retry_queue *q);
+static void connection_timeout(connection *conn);
+static void connection_complete(connection *conn);
+static void record_file_size(connection *conn);
+static void skip_file(size_t item);
+static size_t take_budget(size_t wanted);
+static bool budget_spent(void);
+static void skip_directory(size_t item);
+static bool within_limits(void);
+static void drop_frontier(void);
+static void release_frontier(void);
+static int schedule_next(size_t *item);
+static file_sample *find_sample(size_t item);
+static void frontier_push(frontier *q, size_t item);
+static size_t frontier_pop(frontier *q);
+static size_t frontier_take(frontier *q);
+static long long monotonic_ms(void);
+static long long monotonic_us(void);
+static void record_request(int phase, request_timing *timing);
+static void record_latency(histogram *h, long long value);
+static double latency_percentile(histogram *h, double fraction);
+static void merge_metrics(phase_metrics *dest, phase_metrics *src);
+static void print_metrics(FILE *out, phase_metrics *metrics);
+static void print_latency(FILE *out, char *name, histogram *h);
+static void write_metrics(const char *path, phase_metrics *metrics);
+static void write_latency(FILE *file, char *name, histogram *h, bool last);
+static void log_request(char *request);
+static void log_message(int level, FILE *stream, const char *format, ...)
+    __attribute__((format(printf, 3, 4)));
+static void log_append(FILE *stream, char *text, size_t length);
+static void *log_writer(void *arg);
+static void log_start(void);
+static void log_flush(void);
+static void log_stop(void);
+static char *log_timestamp(void);
+static void index_response(connection *conn, bool final);
+static size_t index_line(menu_line *line, char *request);
+static int classify_line(menu_line *line, char *request, char **record);
+static size_t store_item(int item_type, char *record, ssize_t size);
+static char *find_next_line(char *ptr, char *end, menu_line *line);
+static uint32_t delimiter_mask_scalar(const char *ptr, size_t length);
+static void select_tokenizer(void);
+static ssize_t print_response(int sock, char *request);
+static void print_content(char *content);
+static void abort_connection(int sock);
+static size_t add_item(int item_type, char *record, ssize_t size);
+static size_t index_item(int item_type, char *record);
+static size_t find_item(int item_type, char *record);
+static bool insert_item(size_t item);
+static uint64_t hash_item(int item_type, char *record);
+static uint64_t hash_string(uint64_t hash, char *str);
+static uint64_t hash_bytes(uint64_t hash, char *data, size_t length);
+static void content_start(content_hash *h);
+static void content_update(content_hash *h, char *data, size_t length);
+static uint64_t content_digest(content_hash *h);
+static uint64_t content_round(uint64_t lane, uint64_t input);
+static uint64_t content_read64(unsigned char *p);
+static void *arena_alloc(size_t size);
+static char *intern_string(char *str);
+static void evaluate(void);
+static void cleanup(void);
+static void list_full_path(int item_type);
+static void print_issue(FILE *out, size_t item);
+static void list_duplicates(void);
+static int compare_contents(const void *a, const void *b);
+static void tally_size(size_t item);
+static bool open_listings(void);
+static void close_listings(void);
+static void test_external_servers(void);
+static void probe_attempt(external_probe *probe, size_t index,
+                          int epoll_fd);
+static int compare_probes(const void *a, const void *b);
+static struct addrinfo *cached_addresses(char *hostname);
+static void resolve_hosts(char **hostnames, size_t count);
+static dns_record *find_dns_record(char *hostname);
+static dns_record *create_dns_record(char *hostname);
+static bool server_address(address_race *race);
+static bool server_candidates(long long now);
+static socklen_t set_address(struct sockaddr_storage *dest,
+                             struct addrinfo *addr, int port);
+static bool same_address(struct sockaddr_storage *a, struct sockaddr *b);
+static void release_dns_cache(void);
+static void load_index(char *path);
+static bool validate_index(saved_index *index);
+static index_record *find_saved(int item_type, char *record);
+static bool match_line(connection *conn, menu_line *line);
+static void index_matched(connection *conn);
+static void replay_directory(size_t directory, index_record *saved);
+static void log_link(size_t parent, size_t child);
+static void save_index(char *path);
+static void release_index(void);
+static bool open_checkpoint(char *path, bool resume);
+static bool restore_checkpoint(char *path);
+static void filter_frontier(frontier *f, int job);
+static void log_checkpoint(int kind, size_t item, int64_t value);
+static void append_checkpoint(int kind, int item_type, char *record,
+                              int64_t value);
+static void flush_checkpoint(bool sync);
+static void close_checkpoint(void);
+static void open_output(char *path);
+static void output_item(size_t item, int status, int64_t size,
+                        long long latency_us);
+static void output_entry(int item_type, char *selector, char *host, int port,
+                         int status, int64_t size, long long latency_us);
+static size_t escape_json(char *dest, char *str, size_t length);
+static void flush_output(void);
+static void close_output(void);
+
+/* Global variables: values used across all functions */
+static __thread gopher_context *context = NULL;  // Crawl of the thread
+static __thread const gopher_options *options = NULL;  // Options of the crawl
+static __thread server_state *current = NULL;  // Server crawled by the thread
+static atomic_bool fast_open = true;    // Whether TCP Fast Open is available
+static atomic_bool discard_in_kernel = true;  // Whether recv() can discard
+static const int default_timeouts[NUM_OF_PHASES][NUM_OF_DEADLINES] = {
+    {10000, 10000, 10000, 0},   // Directory indices, however long they are
+    {10000, 10000, 10000, 5000},  // Files, which have to finish in time
+    {5000, 0, 0, 0}             // External servers, only connected to
+};                                      // Milliseconds allowed, 0 if no limit
+static const unsigned char item_classes[256] = {
+    ['0'] = CLASS_TEXT, ['1'] = CLASS_DIRECTORY, ['2'] = CLASS_NAMESERVER,
+    ['3'] = CLASS_ERROR, ['4'] = CLASS_BINARY, ['5'] = CLASS_BINARY,
+    ['6'] = CLASS_BINARY, ['7'] = CLASS_SEARCH, ['8'] = CLASS_TELNET,
+    ['9'] = CLASS_BINARY, ['+'] = CLASS_MIRROR, ['T'] = CLASS_TELNET,
+    ['g'] = CLASS_BINARY, ['I'] = CLASS_BINARY, [':'] = CLASS_BINARY,
+    [';'] = CLASS_BINARY, ['<'] = CLASS_BINARY, ['d'] = CLASS_BINARY,
+    ['h'] = CLASS_HYPERTEXT, ['p'] = CLASS_BINARY, ['r'] = CLASS_BINARY,
+    ['s'] = CLASS_BINARY, ['P'] = CLASS_BINARY, ['X'] = CLASS_BINARY,
+    ['i'] = CLASS_INFO
+};                                      // Class of every type character
+static const int default_class_types[NUM_OF_CLASSES] = {
+    [CLASS_IGNORED] = NOT_INDEXED, [CLASS_DIRECTORY] = DIRECTORY,
+    [CLASS_TEXT] = TEXT, [CLASS_BINARY] = BINARY, [CLASS_ERROR] = ERROR,
+    [CLASS_SEARCH] = NOT_INDEXED, [CLASS_HYPERTEXT] = BINARY,
+    [CLASS_TELNET] = NOT_INDEXED, [CLASS_NAMESERVER] = NOT_INDEXED,
+    [CLASS_MIRROR] = NOT_INDEXED, [CLASS_INFO] = NOT_INDEXED
+};                                      // Item type indexed by default
+static char *listing_names[NUM_OF_TYPES] = {
+    [TEXT] = "text-files.txt", [BINARY] = "binary-files.txt",
+    [ERROR] = ISSUES_LISTING, [TIMEOUT] = ISSUES_LISTING,
+    [TOO_LARGE] = ISSUES_LISTING, [CONNECT_FAILED] = ISSUES_LISTING,
+    [SEARCH] = "search-servers.txt", [LINK] = "url-links.txt"
+};                                      // Listings streamed of every type
+static uint32_t (*delimiter_mask)(const char *, size_t)
+    = delimiter_mask_scalar;             // Tokenizer chosen for the CPU
+static pthread_once_t tokenizer_selected = PTHREAD_ONCE_INIT;
+static log_ring logger = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .ready = PTHREAD_COND_INITIALIZER,
+    .drained = PTHREAD_COND_INITIALIZER
+};                                      // Messages of all crawls pending
+
+/**
+ * Fill the options of a crawl with their defaults.
+ * 
+ * @param options options to be filled
+ */
+void gopher_default_options(gopher_options *options) {
+    memset(options, 0, sizeof(*options));
+    options->concurrency = DEFAULT_CONCURRENCY;
+    options->cache_limit = CACHE_LIMIT;
+    options->num_of_threads = DEFAULT_THREADS;
+    options->max_retries = DEFAULT_RETRIES;
+    memcpy(options->timeouts, default_timeouts, sizeof(default_timeouts));
+    options->file_limit = FILE_LIMIT;
+    options->crawl_order = ORDER_BREADTH;
+    options->max_depth = -1;
+    options->output_format = OUTPUT_JSONL;
+    options->verbosity = LOG_INFO;
+}
+
+/**
+ * Create the context of a crawl. The options are copied, but the pathnames
+ * they refer to are not.
+ * 
+ * @param options options of the crawl
+ * @param callback receiver of every entry once its outcome is known, or NULL
+ * @param user_data argument given to the callback
+ * @return context of the crawl, NULL if out of memory
+ */
+gopher_context *gopher_create(const gopher_options *options,
+                              gopher_callback callback, void *user_data) {
+    // Use the fastest tokenizer for directory indices supported by the CPU
+    pthread_once(&tokenizer_selected, select_tokenizer);
+
+    gopher_context *ctx = calloc(1, sizeof(gopher_context));
+    if (ctx == NULL) return NULL;
+    ctx->options = *options;
+    ctx->callback = callback;
+    ctx->user_data = user_data;
+    pthread_mutex_init(&ctx->servers_lock, NULL);
+    pthread_cond_init(&ctx->servers_changed, NULL);
+    pthread_mutex_init(&ctx->resolver_lock, NULL);
+    pthread_mutex_init(&ctx->callback_lock, NULL);
+    memcpy(ctx->class_types, default_class_types,
+           sizeof(default_class_types));
+    if (options->include_search) ctx->class_types[CLASS_SEARCH] = SEARCH;
+    atomic_init(&ctx->budget, options->size_budget);
+
+    // Directory indices saved with other types included or another file
+    // limit are parsed again, so that their files are measured again
+    ctx->index_seed = FNV_OFFSET;
+    if (options->include_search)
+        ctx->index_seed = hash_string(ctx->index_seed, "search");
+    if (options->include_links)
+        ctx->index_seed = hash_string(ctx->index_seed, "links");
+    if (options->file_limit != FILE_LIMIT)
+        ctx->index_seed = hash_bytes(ctx->index_seed,
+                                     (char *)&options->file_limit,
+                                     sizeof(options->file_limit));
+
+    return ctx;
+}
+
+/**
+ * Add a Gopher server to be crawled by a context, unless it has been added
+ * before.
+ * 
+ * @param ctx context of the crawl
+ * @param hostname hostname or IP address of the server
+ * @param port port of the server
+ * @return whether the server was added
+ */
+bool gopher_add_server(gopher_context *ctx, const char *hostname, int port) {
+    gopher_context *outer = enter_context(ctx);
+    bool added = add_server(hostname, port, 0);
+    enter_context(outer);
+
+    return added;
+}
+
+/**
+ * Crawl the servers of a context in parallel, each by a single worker thread,
+ * and write the metrics of all crawls if requested. Reports are held until
+ * gopher_print_reports() is called.
+ * 
+ * @param ctx context of the crawl
+ * @return false if no server was given, a single server was unreachable or
+ *         a crawl stopped on an error
+ */
+bool gopher_crawl(gopher_context *ctx) {
+    if (ctx->servers.count == 0) return false;
+    gopher_context *outer = enter_context(ctx);
+    context->multi_server = context->servers.count > 1
+                            || options->follow_external > 0;
+
+    log_start();
+    int num_of_workers = options->num_of_threads;
+    if (options->follow_external == 0
+            && context->servers.count < (size_t)num_of_workers)
+        num_of_workers = context->servers.count;
+    pthread_t workers[num_of_workers];
+    int started = 0;
+    while (started < num_of_workers
+           && pthread_create(&workers[started], NULL, crawl_worker, ctx) == 0)
+        started++;
+    // The workers started crawl all the servers, albeit fewer at once
+    if (started < num_of_workers)
+        log_message(started == 0 ? LOG_FATAL : LOG_ERROR, stderr,
+                    "Error: Thread creation failed\n");
+    for (int i = 0; i < started; i++) pthread_join(workers[i], NULL);
+
+    // The reports are printed after all pending messages
+    log_stop();
+    if (options->metrics_path != NULL) {
+        phase_metrics totals[NUM_OF_PHASES];
+        memset(totals, 0, sizeof(totals));
+        for (size_t i = 0; i < context->servers.count; i++)
+            merge_metrics(totals, context->servers.servers[i]->metrics);
+        write_metrics(options->metrics_path, totals);
+    }
+    bool crawled = started > 0;
+    if (!context->multi_server && context->servers.servers[0]->unreachable)
+        crawled = false;
+    for (size_t i = 0; i < context->servers.count; i++)
+        if (context->servers.servers[i]->failed) crawled = false;
+    enter_context(outer);
+
+    return crawled;
+}
+
+/**
+ * Free a context and the states of its servers.
+ * 
+ * @param ctx context of the crawl, or NULL
+ */
+void gopher_destroy(gopher_context *ctx) {
+    if (ctx == NULL) return;
+    gopher_context *outer = enter_context(ctx);
+    release_servers();
+    release_dns_cache();
+    enter_context(outer);
+
+    pthread_mutex_destroy(&ctx->servers_lock);
+    pthread_cond_destroy(&ctx->servers_changed);
+    pthread_mutex_destroy(&ctx->resolver_lock);
+    pthread_mutex_destroy(&ctx->callback_lock);
+    free(ctx);
+}
+
+/**
+ * Make a context the one of the calling thread, which every function below
+ * refers to.
+ * 
+ * @param ctx context of the crawl, or NULL
+ * @return context of the thread before the call
+ */
+static gopher_context *enter_context(gopher_context *ctx) {
+    gopher_context *outer = context;
+    context = ctx;
+    options = ctx != NULL ? &ctx->options : NULL;
+
+    return outer;
+}
+
+/**
+ * Add a Gopher server to the servers to be crawled, unless it has been added
+ * before. Hostnames are compared case-insensitively.
+ * 
+ * @param hostname hostname or IP address of the server
+ * @param port port of the server
+ * @param hop number of external references followed to reach the server
+ * @return whether the server was added
+ */
+static bool add_server(const char *hostname, int port, int hop) {
+    pthread_mutex_lock(&context->servers_lock);
+    for (size_t i = 0; i < context->servers.count; i++) {
+        server_state *server = context->servers.servers[i];
+        if (server->port == port
+                && strcasecmp(server->hostname, hostname) == 0) {
+            pthread_mutex_unlock(&context->servers_lock);
+            return false;
+        }
+    }
+
+    server_list *list = &context->servers;
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity == 0 ? 16 : list->capacity * 2;
+        server_state **servers = realloc(list->servers,
+                                         capacity * sizeof(server_state *));
+        if (servers == NULL) {
+            pthread_mutex_unlock(&context->servers_lock);
+            memory_failed();
+            return false;
+        }
+        list->servers = servers;
+        list->capacity = capacity;
+    }
+    server_state *server = calloc(1, sizeof(server_state));
+    char *copy = strdup(hostname);
+    if (server == NULL || copy == NULL) {
+        pthread_mutex_unlock(&context->servers_lock);
+        free(server);
+        free(copy);
+        memory_failed();
+        return false;
+    }
+    server->hostname = copy;
+    server->port = port;
+    server->hop = hop;
+    server->smallest.item = ROOT;
+    server->checkpoint.fd = -1;
+    server->output.fd = -1;
+    server->jitter = (unsigned int)time(NULL) ^ (unsigned int)getpid()
+                     ^ (unsigned int)list->count;
+    list->servers[list->count++] = server;
+    pthread_cond_broadcast(&context->servers_changed);
+    pthread_mutex_unlock(&context->servers_lock);
+
+    return true;
+}
+
+/**
+ * Take the servers to be crawled one at a time until none remains. A worker
+ * waits while the others are still crawling, since they may add the servers
+ * of the external references they follow.
+ * 
+ * @param arg context of the crawl
+ * @return NULL
+ */
+static void *crawl_worker(void *arg) {
+    enter_context(arg);
+    pthread_mutex_lock(&context->servers_lock);
+    for (;;) {
+        while (context->next_server == context->servers.count
+                && context->busy_workers > 0)
+            pthread_cond_wait(&context->servers_changed,
+                              &context->servers_lock);
+        if (context->next_server == context->servers.count) break;
+
+        server_state *server =
+            context->servers.servers[context->next_server++];
+        context->busy_workers++;
+        pthread_mutex_unlock(&context->servers_lock);
+        crawl_server(server);
+        pthread_mutex_lock(&context->servers_lock);
+        context->busy_workers--;
+        pthread_cond_broadcast(&context->servers_changed);
+    }
+    pthread_mutex_unlock(&context->servers_lock);
+
+    return NULL;
+}
+
+/**
+ * Crawl a Gopher server and evaluate its report, which is held in memory
+ * until all servers have been crawled. Only the metrics and the number of
+ * items of every type are kept after the crawl.
+ * 
+ * @param server state of the server
+ */
+static void crawl_server(server_state *server) {
+    current = server;
+    server->report = open_memstream(&server->report_data,
+                                    &server->report_size);
+    if (server->report == NULL) {
+        memory_failed();
+        current = NULL;
+        return;
+    }
+
+    // Convert hostname into IP address
+    resolve_hosts(&server->hostname, 1);
+    pthread_mutex_lock(&context->resolver_lock);
+    bool resolved = cached_addresses(server->hostname) != NULL;
+    pthread_mutex_unlock(&context->resolver_lock);
+    if (!resolved) {
+        log_message(context->multi_server ? LOG_ERROR : LOG_FATAL, stderr,
+                    "Error: unable to connect to host %s\n", server->hostname);
+        fprintf(server->report, "Error: unable to connect to host %s\n",
+                server->hostname);
+        fclose(server->report);
+        server->unreachable = true;
+        current = NULL;
+        return;
+    }
+
+    // Begin the indexing process, starting with the root directory
+    server->index_path = server_path(options->index_path);
+    server->checkpoint_path = server_path(options->checkpoint_path);
+    server->listing_path = server_path(options->listing_path);
+    if (server->listing_path != NULL && !open_listings()) server_failed();
+    server->output_path = server_path(options->output_path);
+    if (server->output_path != NULL) open_output(server->output_path);
+    if (server->index_path != NULL) load_index(server->index_path);
+    frontier_push(&server->queue, store_item(DIRECTORY, "", SIZE_PENDING));
+    if (server->checkpoint_path != NULL && !server->failed) {
+        // A server added after the interruption has nothing to resume
+        bool logged = access(server->checkpoint_path, F_OK) == 0;
+        if (!open_checkpoint(server->checkpoint_path, options->resume
+                             && (logged || !context->multi_server)))
+            server_failed();
+    }
+    if (!server->failed) crawl();
+    else release_frontier();
+    close_checkpoint();
+    if (server->index_path != NULL && !server->unreachable && !server->failed)
+        save_index(server->index_path);
+
+    // Analyse the information of the indexed items into the report
+    if (!server->failed) evaluate();
+    else free(server->smallest.data);
+    close_listings();
+    close_output();
+    fclose(server->report);
+    for (int i = 0; i < NUM_OF_TYPES; i++)
+        server->totals[i] = server->store.by_type[i].count;
+
+    // Crawl the servers referenced next, up to the hops allowed
+    if (server->hop < options->follow_external && !server->failed) {
+        type_index *externals = &server->store.by_type[EXTERNAL];
+        for (size_t i = 0; i < externals->count; i++) {
+            char *record = server->store.records[externals->items[i]];
+            char *port = strchr(record, '\t');
+            size_t length = port != NULL ? (size_t)(port - record)
+                                         : strlen(record);
+            char hostname[length + 1];
+            memcpy(hostname, record, length);
+            hostname[length] = '\0';
+            int number = port != NULL ? atoi(port + 1)
+                                      : GOPHER_DEFAULT_PORT;
+            if (add_server(hostname, number, server->hop + 1))
+                log_message(LOG_INFO, stdout, "Following external server %s "
+                            "at port %d\n", hostname, number);
+        }
+    }
+
+    // Clean up the state of the crawl
+    cleanup();
+    release_index();
+    current = NULL;
+}
+
+/**
+ * Name the file of the current server for an option given a pathname. When
+ * several servers are crawled, the hostname and the port are appended so
+ * that every server has its own file.
+ * 
+ * @param path pathname given to the option, or NULL
+ * @return pathname of the file of the current server, NULL if none or out of
+ *         memory, which fails the crawl
+ */
+static char *server_path(const char *path) {
+    if (path == NULL) return NULL;
+    size_t length = strlen(path) + strlen(current->hostname) + 16;
+    char *name = malloc(length);
+    if (name == NULL) {
+        memory_failed();
+        return NULL;
+    }
+    if (!context->multi_server) memcpy(name, path, strlen(path) + 1);
+    else snprintf(name, length, "%s-%s-%d", path, current->hostname,
+                  current->port);
+    return name;
+}
+
+/**
+ * Print the reports of all servers in the order they were added. When
+ * several servers are crawled, every report is headed by its server and the
+ * reports are followed by a summary of all crawls. Nothing is printed before
+ * gopher_crawl() has been called.
+ * 
+ * @param ctx context of the crawl
+ * @param out stream of the reports
+ */
+void gopher_print_reports(gopher_context *ctx, FILE *out) {
+    gopher_context *outer = enter_context(ctx);
+    // Nothing is printed until a crawl has produced a report
+    bool produced = false;
+    for (size_t i = 0; i < context->servers.count; i++)
+        if (context->servers.servers[i]->report_data != NULL) produced = true;
+    if (!produced) {
+        enter_context(outer);
+        return;
+    }
+    if (!context->multi_server) {
+        fwrite(context->servers.servers[0]->report_data, 1,
+               context->servers.servers[0]->report_size, out);
+        enter_context(outer);
+        return;
+    }
+
+    size_t totals[NUM_OF_TYPES] = {0};
+    phase_metrics metrics[NUM_OF_PHASES];
+    memset(metrics, 0, sizeof(metrics));
+    for (size_t i = 0; i < context->servers.count; i++) {
+        server_state *server = context->servers.servers[i];
+        fprintf(out, "\n==== Server %s at port %d", server->hostname,
+                server->port);
+        if (server->hop > 0)
+            fprintf(out, " (%d external hop%s away)", server->hop,
+                    server->hop > 1 ? "s" : "");
+        if (server->unreachable)
+            fprintf(out, " (connection failed)");
+        else if (server->failed)
+            fprintf(out, " (crawl failed)");
+        fprintf(out, " ====\n");
+        fwrite(server->report_data, 1, server->report_size, out);
+        for (int t = 0; t < NUM_OF_TYPES; t++) totals[t] += server->totals[t];
+        merge_metrics(metrics, server->metrics);
+    }
+
+    fprintf(out, "\n==== Summary of %zu servers ====\n"
+                    "\nNumber of directories: %zu\n"
+                    "Number of text files: %zu\n"
+                    "Number of binary files: %zu\n"
+                    "Number of invalid references: %zu\n"
+                    "Number of references to external servers: %zu\n",
+            context->servers.count, totals[DIRECTORY], totals[TEXT],
+            totals[BINARY], totals[ERROR], totals[EXTERNAL]);
+    if (context->class_types[CLASS_SEARCH] == SEARCH)
+        fprintf(out, "Number of search servers: %zu\n", totals[SEARCH]);
+    if (options->include_links)
+        fprintf(out, "Number of URL links: %zu\n", totals[LINK]);
+    print_metrics(out, metrics);
+    enter_context(outer);
+}
+
+/**
+ * Free the states of all servers once the context is destroyed.
+ */
+static void release_servers(void) {
+    for (size_t i = 0; i < context->servers.count; i++) {
+        server_state *server = context->servers.servers[i];
+        free(server->hostname);
+        free(server->index_path);
+        free(server->checkpoint_path);
+        free(server->report_data);
+        free(server);
+    }
+    free(context->servers.servers);
+    context->servers.servers = NULL;
+    context->servers.count = 0;
+}
+
+/**
+ * Establish a connection with the Gopher server.
+ * 
+ * @param func function handling response from the Gopher server
+ * @param request request to be send to the Gopher server
+ * @return the output from the function handling response
+ */
+static ssize_t gopher_connect(ssize_t (*func)(int, char *), char *request) {
+    // Append "\r\n" to the end of the path to form a request line
+    size_t path_length = strlen(request);
+    char new_request[path_length + 3];
+    memcpy(new_request, request, path_length);
+    new_request[path_length] = '\r';
+    new_request[path_length + 1] = '\n';
+    new_request[path_length + 2] = '\0';
+
+    // Connect, sending as much of the request as possible with the SYN
+    size_t sent;
+    long long opened = monotonic_ms();
+    int sock = server_connect(PHASE_SIZE, SOCK_NONBLOCK, 0, new_request,
+                              path_length + 2, &sent);
+    if (sock == -1) {
+        log_message(LOG_ERROR, stderr, "Error: Connection failed\n");
+        index_item(CONNECT_FAILED, new_request);
+        return -1;
+    }
+
+    // Wait for the connection, then send the rest of the request
+    long long deadline = request_deadline(PHASE_SIZE, DEADLINE_CONNECT,
+                                          opened, 0);
+    while (sent < path_length + 2) {
+        if (!wait_socket(sock, POLLOUT, deadline)) {
+            log_message(LOG_ERROR, stderr, "Error: Server response timeout\n");
+            index_item(TIMEOUT, new_request);
+            close(sock);
+            return -1;
+        }
+        ssize_t bytes_sent = send(sock, new_request + sent,
+                                  path_length + 2 - sent, MSG_NOSIGNAL);
+        if (bytes_sent == -1 && (errno == EWOULDBLOCK || errno == EAGAIN
+                                 || errno == EINTR))
+            continue;
+        if (bytes_sent == -1) {
+            log_message(LOG_ERROR, stderr, "Error: Unable to send request\n");
+            index_item(CONNECT_FAILED, new_request);
+            close(sock);
+            return -1;
+        }
+        sent += bytes_sent;
+    }
+    log_request(new_request);
+
+    // Execute the function that receives and handles server's response
+    int output = (*func)(sock, new_request);
+
+    // Terminate the connection and release the socket
+    close(sock);
+
+    return output;
+}
+
+/**
+ * Create a TCP socket and connect it to the Gopher server. The first
+ * connection to a server with several addresses races them, waiting for the
+ * winner, and the address connected first is used by all the following
+ * connections.
+ * 
+ * @param phase phase of the request, whose connect deadline ends the race
+ * @param flags SOCK_NONBLOCK for a non-blocking connection, otherwise 0
+ * @param rcvbuf size of the receive buffer in bytes, 0 for the default
+ * @param request request line to send on connection
+ * @param length length of the request line
+ * @param sent number of bytes of the request already sent (output)
+ * @return socket file descriptor, -1 on failure
+ */
+static int server_connect(int phase, int flags, int rcvbuf, char *request,
+                          size_t length, size_t *sent) {
+    *sent = 0;
+
+    // Specify the IP address and the port for connection
+    address_race race;
+    if (!server_address(&race)) return -1;
+    if (race.count == 0)
+        return server_socket(flags, rcvbuf, request, length, sent);
+
+    long long deadline = request_deadline(phase, DEADLINE_CONNECT,
+                                          monotonic_ms(), 0);
+    int sock = race_connect(&race, rcvbuf, deadline);
+    race_finish(&race);
+    if (sock != -1 && (flags & SOCK_NONBLOCK) == 0)
+        fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) & ~O_NONBLOCK);
+    return sock;
+}
+
+/**
+ * Create a TCP socket and connect it to the address chosen for the Gopher
+ * server. Small requests are answered sooner with Nagle's algorithm disabled,
+ * and where TCP Fast Open is supported, the request line is carried by the
+ * SYN so that the server can answer one round trip earlier. Without a Fast
+ * Open cookie for the server, a plain SYN is sent (requesting a cookie) and
+ * nothing of the request is sent, so the caller sends it all once the
+ * connection is established. The receive buffer is sized before connecting,
+ * as the window scale offered to the server is fixed by the SYN.
+ * 
+ * @param flags SOCK_NONBLOCK for a non-blocking connection, otherwise 0
+ * @param rcvbuf size of the receive buffer in bytes, 0 for the default
+ * @param request request line to send on connection
+ * @param length length of the request line
+ * @param sent number of bytes of the request already sent (output)
+ * @return socket file descriptor, -1 on failure
+ */
+static int server_socket(int flags, int rcvbuf, char *request,
+                         size_t length, size_t *sent) {
+    *sent = 0;
+    socklen_t addr_len = current->addr_len;
+
+    int sock = socket(current->addr.ss_family,
+                      SOCK_STREAM | SOCK_CLOEXEC | flags, 0);
+    if (sock == -1) return -1;
+    int enable = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+    if (rcvbuf > 0)
+        setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+#ifdef MSG_FASTOPEN
+    if (fast_open) {
+        ssize_t bytes_sent = sendto(sock, request, length,
+                                    MSG_FASTOPEN | MSG_NOSIGNAL,
+                                    (struct sockaddr *)&current->addr,
+                                    addr_len);
+        if (bytes_sent >= 0) {
+            *sent = bytes_sent;
+            return sock;
+        }
+        if (errno == EINPROGRESS) return sock;
+        // Fall back to a regular connection if unsupported by the system
+        if (errno != EOPNOTSUPP && errno != EPROTONOSUPPORT) {
+            close(sock);
+            return -1;
+        }
+        fast_open = false;
+    }
+#else
+    (void)request;
+    (void)length;
+#endif
+
+    if (connect(sock, (struct sockaddr *)&current->addr, addr_len) == -1
+            && errno != EINPROGRESS) {
+        close(sock);
+        return -1;
+    }
+
+    return sock;
+}
+
+/**
+ * Prepare a race between the addresses resolved for a hostname. The address
+ * families alternate, starting with the family preferred by getaddrinfo(), so
+ * that a broken IPv6 or IPv4 route only delays a connection by RACE_DELAY.
+ * 
+ * @param race race to prepare
+ * @param list addresses resolved by getaddrinfo()
+ * @param port port number in host byte order
+ */
+static void race_prepare(address_race *race, struct addrinfo *list, int port) {
+    race->count = 0;
+    race->started = 0;
+    race->winner = -1;
+    race->next = 0;
+    int family = list != NULL ? list->ai_family : AF_UNSPEC;
+    struct addrinfo *preferred = list;
+    struct addrinfo *other = list;
+    while (race->count < RACE_CANDIDATES) {
+        while (preferred != NULL && preferred->ai_family != family)
+            preferred = preferred->ai_next;
+        while (other != NULL && other->ai_family == family)
+            other = other->ai_next;
+        if (preferred == NULL && other == NULL) break;
+        if (preferred != NULL) {
+            race_add(race, preferred, port);
+            preferred = preferred->ai_next;
+        }
+        if (other != NULL && race->count < RACE_CANDIDATES) {
+            race_add(race, other, port);
+            other = other->ai_next;
+        }
+    }
+}
+
+/**
+ * Append an address to the candidates of a race.
+ * 
+ * @param race race being prepared
+ * @param addr address resolved by getaddrinfo()
+ * @param port port number in host byte order
+ */
+static void race_add(address_race *race, struct addrinfo *addr, int port) {
+    race->lengths[race->count] = set_address(&race->addrs[race->count], addr,
+                                             port);
+    race->fds[race->count] = -1;
+    race->count++;
+}
+
+/**
+ * Start a non-blocking connection to the next address of a race. Addresses
+ * failing at once, e.g. of a family without a route, are skipped.
+ * 
+ * @param race race in progress
+ * @param rcvbuf size of the receive buffer in bytes, 0 for the default
+ * @return socket of the attempt, -1 if no address is left
+ */
+static int race_attempt(address_race *race, int rcvbuf) {
+    while (race->started < race->count) {
+        int attempt = race->started++;
+        race->next = monotonic_ms() + RACE_DELAY;
+        int sock = socket(race->addrs[attempt].ss_family,
+                          SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (sock == -1) continue;
+        int enable = 1;
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+        if (rcvbuf > 0)
+            setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+        int status = connect(sock, (struct sockaddr *)&race->addrs[attempt],
+                             race->lengths[attempt]);
+        if (status == -1 && errno != EINPROGRESS) {
+            close(sock);
+            continue;
+        }
+        race->fds[attempt] = sock;
+        // A connection established at once wins the race straight away
+        if (status == 0) race_check(race, attempt);
+        return sock;
+    }
+    return -1;
+}
+
+/**
+ * Check an attempt of a race whose socket has become writable. The first
+ * attempt established wins, and every other attempt is closed.
+ * 
+ * @param race race in progress
+ * @param attempt position of the attempt
+ * @return whether the attempt has won the race
+ */
+static bool race_check(address_race *race, int attempt) {
+    int so_error;
+    socklen_t len = sizeof so_error;
+    getsockopt(race->fds[attempt], SOL_SOCKET, SO_ERROR, &so_error, &len);
+    if (so_error != 0) {
+        close(race->fds[attempt]);
+        race->fds[attempt] = -1;
+        return false;
+    }
+    race->winner = attempt;
+    for (int i = 0; i < race->started; i++) {
+        if (i == attempt || race->fds[i] == -1) continue;
+        close(race->fds[i]);
+        race->fds[i] = -1;
+    }
+    return true;
+}
+
+/**
+ * @param race race in progress
+ * @return whether an attempt is still connecting
+ */
+static bool race_pending(address_race *race) {
+    if (race->winner != -1) return false;
+    for (int i = 0; i < race->started; i++)
+        if (race->fds[i] != -1) return true;
+    return false;
+}
+
+/**
+ * Connect to whichever address of a race is established first, waiting up
+ * to a deadline.
+ * 
+ * @param race race prepared with the addresses of the server
+ * @param rcvbuf size of the receive buffer in bytes, 0 for the default
+ * @param deadline monotonic time (ms) at which to give up, or NO_DEADLINE
+ * @return non-blocking socket of the winner, -1 if none is established
+ */
+static int race_connect(address_race *race, int rcvbuf, long long deadline) {
+    race_attempt(race, rcvbuf);
+    while (race->winner == -1) {
+        struct pollfd fds[RACE_CANDIDATES];
+        int attempts[RACE_CANDIDATES];
+        int n = 0;
+        for (int i = 0; i < race->started; i++) {
+            if (race->fds[i] == -1) continue;
+            fds[n].fd = race->fds[i];
+            fds[n].events = POLLOUT;
+            attempts[n++] = i;
+        }
+        bool more = race->started < race->count;
+        long long now = monotonic_ms();
+        if ((n == 0 && !more) || (deadline != NO_DEADLINE && now >= deadline))
+            break;
+
+        // The next address is attempted once the previous ones have failed
+        // or the delay has passed
+        if (more && (n == 0 || now >= race->next)) {
+            race_attempt(race, rcvbuf);
+            continue;
+        }
+        long long until = deadline;
+        if (more && (until == NO_DEADLINE || race->next < until))
+            until = race->next;
+        int ready = poll(fds, n, until == NO_DEADLINE ? -1
+                                                      : (int)(until - now));
+        if (ready == -1 && errno != EINTR) break;
+        for (int i = 0; i < n && race->winner == -1; i++)
+            if (fds[i].revents != 0) race_check(race, attempts[i]);
+    }
+
+    for (int i = 0; i < race->started; i++) {
+        if (i == race->winner || race->fds[i] == -1) continue;
+        close(race->fds[i]);
+        race->fds[i] = -1;
+    }
+    return race->winner != -1 ? race->fds[race->winner] : -1;
+}
+
+/**
+ * Record the outcome of a race of the addresses of the current server. The
+ * winner is used by the following connections. After a failed race, they
+ * use the first address until RACE_BACKOFF has passed, rather than race
+ * again each time.
+ * 
+ * @param race race which has ended
+ */
+static void race_finish(address_race *race) {
+    if (race->winner == -1) {
+        current->rerace = monotonic_ms() + RACE_BACKOFF;
+        return;
+    }
+    log_message(LOG_DEBUG, stdout, "Connected to address %d of %d first\n",
+                race->winner + 1, race->count);
+    current->addr = race->addrs[race->winner];
+    current->addr_len = race->lengths[race->winner];
+    current->rerace = 0;
+}
+
+/**
+ * Start racing the addresses of the current server for a connection of the
+ * crawl engine. Every attempt is awaited on the event loop like any other
+ * connection, and the next attempt is due in the deadline heap, so that no
+ * other request waits for the race. No other connection is opened until the
+ * race ends.
+ * 
+ * @param conn connection for which the race is run
+ * @param epoll_fd epoll instance of the crawl
+ */
+static void race_start(connection *conn, int epoll_fd) {
+    current->racer = conn;
+    conn->fd = -1;
+    conn->state = CONN_RACING;
+    race_advance(conn, epoll_fd);
+}
+
+/**
+ * Advance the race of a connection once one of its attempts has become
+ * writable or the next attempt is due. Attempts are started as long as the
+ * previous ones have failed or RACE_DELAY has passed, and the connection
+ * carries on with the first attempt established.
+ * 
+ * @param conn connection running the race
+ * @param epoll_fd epoll instance of the crawl
+ */
+static void race_advance(connection *conn, int epoll_fd) {
+    address_race *race = &current->race;
+
+    // Check the attempts whose sockets have become writable
+    struct pollfd fds[RACE_CANDIDATES];
+    int attempts[RACE_CANDIDATES];
+    int n = 0;
+    for (int i = 0; i < race->started; i++) {
+        if (race->fds[i] == -1) continue;
+        fds[n].fd = race->fds[i];
+        fds[n].events = POLLOUT;
+        attempts[n++] = i;
+    }
+    if (n > 0 && poll(fds, n, 0) > 0) {
+        for (int i = 0; i < n && race->winner == -1; i++)
+            if (fds[i].revents != 0) race_check(race, attempts[i]);
+    }
+
+    long long now = monotonic_ms();
+    long long deadline = request_deadline(conn->job == JOB_INDEX ? PHASE_CRAWL
+                                          : PHASE_SIZE, DEADLINE_CONNECT,
+                                          conn->since, 0);
+    int rcvbuf = conn->job == JOB_SIZE ? SIZE_RCVBUF : 0;
+    while (race->winner == -1 && race->started < race->count
+           && (deadline == NO_DEADLINE || now < deadline)
+           && (!race_pending(race) || now >= race->next)) {
+        int sock = race_attempt(race, rcvbuf);
+        if (sock == -1) break;
+        struct epoll_event event;
+        event.events = EPOLLOUT;
+        event.data.ptr = race;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sock, &event);
+    }
+
+    // The winner carries on like the connection to a single address
+    if (race->winner != -1) {
+        race_finish(race);
+        current->racer = NULL;
+        conn->fd = race->fds[race->winner];
+        conn->state = CONN_CONNECTING;
+        schedule_deadline(conn);
+        struct epoll_event event;
+        event.events = EPOLLOUT;
+        event.data.ptr = conn;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn->fd, &event);
+        return;
+    }
+    if (!race_pending(race) || (deadline != NO_DEADLINE && now >= deadline)) {
+        race_abandon(conn);
+        connection_failed(conn);
+        return;
+    }
+    schedule_deadline(conn);
+}
+
+/**
+ * Give up the race of a connection, closing the attempts still connecting.
+ * 
+ * @param conn connection running the race
+ */
+static void race_abandon(connection *conn) {
+    address_race *race = &current->race;
+    for (int i = 0; i < race->started; i++) {
+        if (race->fds[i] == -1) continue;
+        close(race->fds[i]);
+        race->fds[i] = -1;
+    }
+    race_finish(race);
+    current->racer = NULL;
+    conn->fd = -1;
+}
+
+/**
+ * Print the timestamp at which a request line is sent to the server.
+ * 
+ * @param request the request line sent to the server
+ */
+static void log_request(char *request) {
+    if (options->verbosity < LOG_INFO || current->restoring) return;
+    log_message(LOG_INFO, stdout, "Request sent at %s: %s", log_timestamp(),
+                request);
+}
+
+/**
+ * Log a message at a verbosity level. The message is formatted immediately
+ * but written to the stream later by the background writer, so that the
+ * crawl never waits for the terminal or pipe unless the buffer is full.
+ * 
+ * @param level LOG_FATAL, LOG_ERROR, LOG_INFO or LOG_DEBUG
+ * @param stream stdout or stderr
+ * @param format format of the message, as for printf()
+ */
+static void log_message(int level, FILE *stream, const char *format, ...) {
+    if (options != NULL && level > options->verbosity) return;
+    if (level > LOG_FATAL && current != NULL && current->restoring) return;
+
+    // Name the server of the message when several are crawled at once
+    char line[LOG_LINE];
+    int prefix = 0;
+    if (context != NULL && context->multi_server && current != NULL)
+        prefix = snprintf(line, sizeof(line), "[%.64s:%d] ",
+                          current->hostname, current->port);
+
+    // Format on the stack unless the message is exceptionally long
+    char *text = line;
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(line + prefix, sizeof(line) - prefix, format, args);
+    va_end(args);
+    if (length < 0) return;
+    if ((size_t)(prefix + length) >= sizeof(line)) {
+        text = malloc(prefix + length + 1);
+        if (text != NULL) {
+            memcpy(text, line, prefix);
+            va_start(args, format);
+            vsnprintf(text + prefix, length + 1, format, args);
+            va_end(args);
+        }
+        else {
+            // Out of memory, the message is cut short at the stack buffer
+            text = line;
+            length = sizeof(line) - 1 - prefix;
+        }
+    }
+    length += prefix;
+
+    log_append(stream, text, length);
+    if (text != line) free(text);
+}
+
+/**
+ * Append a formatted message to the ring buffer, waiting for the writer if
+ * the buffer is full. Without a running writer, the message is written out
+ * directly.
+ * 
+ * @param stream stdout or stderr
+ * @param text text of the message
+ * @param length length of the text
+ */
+static void log_append(FILE *stream, char *text, size_t length) {
+    pthread_mutex_lock(&logger.lock);
+    if (!logger.running) {
+        pthread_mutex_unlock(&logger.lock);
+        fwrite(text, 1, length, stream);
+        return;
+    }
+
+    // Truncate a message which could never fit in the buffer
+    if (length > LOG_BUFFER - 2) length = LOG_BUFFER - 2;
+    while (LOG_BUFFER - (logger.head - logger.tail) < length + 2)
+        pthread_cond_wait(&logger.drained, &logger.lock);
+
+    logger.data[logger.head++ % LOG_BUFFER] = stream == stderr ? 2 : 1;
+    size_t start = logger.head % LOG_BUFFER;
+    size_t first = length < LOG_BUFFER - start ? length : LOG_BUFFER - start;
+    memcpy(logger.data + start, text, first);
+    memcpy(logger.data, text + first, length - first);
+    logger.head += length;
+    logger.data[logger.head++ % LOG_BUFFER] = '\0';
+
+    pthread_cond_signal(&logger.ready);
+    pthread_mutex_unlock(&logger.lock);
+}
+
+/**
+ * Write out the messages of the ring buffer in batches until the logger is
+ * stopped. Output to stdout is flushed once per batch rather than per message.
+ * 
+ * @param arg buffer of LOG_BUFFER bytes for a batch, freed by the writer
+ * @return NULL
+ */
+static void *log_writer(void *arg) {
+    char *batch = arg;
+    pthread_mutex_lock(&logger.lock);
+    for (;;) {
+        while (logger.head == logger.tail && !logger.stopping)
+            pthread_cond_wait(&logger.ready, &logger.lock);
+        // Messages appended once stopped are written out directly
+        if (logger.head == logger.tail) {
+            logger.running = false;
+            break;
+        }
+
+        // Take every message appended so far, leaving the buffer free
+        size_t length = logger.head - logger.tail;
+        size_t start = logger.tail % LOG_BUFFER;
+        size_t first = length < LOG_BUFFER - start ? length : LOG_BUFFER - start;
+        memcpy(batch, logger.data + start, first);
+        memcpy(batch + first, logger.data, length - first);
+        logger.tail = logger.head;
+        logger.writing = true;
+        pthread_cond_broadcast(&logger.drained);
+        pthread_mutex_unlock(&logger.lock);
+
+        // Each message is a stream selector, its text and a null byte
+        for (size_t i = 0; i < length; i += strlen(batch + i + 1) + 2)
+            fputs(batch + i + 1, batch[i] == 2 ? stderr : stdout);
+        fflush(stdout);
+
+        pthread_mutex_lock(&logger.lock);
+        logger.flushed += length;
+        logger.writing = false;
+        pthread_cond_broadcast(&logger.drained);
+    }
+    pthread_mutex_unlock(&logger.lock);
+    free(batch);
+
+    return NULL;
+}
+
+/**
+ * Start the background writer of the logger unless a crawl has started it
+ * already. It is shared by all crawls of the process, since they share the
+ * standard streams, and stopped by log_stop() once the last of them ends.
+ */
+static void log_start(void) {
+    pthread_mutex_lock(&logger.lock);
+    logger.crawls++;
+    if (!logger.running) {
+        // Without a writer, the messages are written out directly
+        char *batch = malloc(LOG_BUFFER);
+        logger.stopping = false;
+        logger.running = batch != NULL && pthread_create(&logger.writer, NULL,
+                                                         log_writer,
+                                                         batch) == 0;
+        if (!logger.running) free(batch);
+    }
+    pthread_mutex_unlock(&logger.lock);
+}
+
+/**
+ * Wait until the messages logged so far are written out. Messages appended
+ * meanwhile by other crawls are not waited for.
+ */
+static void log_flush(void) {
+    pthread_mutex_lock(&logger.lock);
+    size_t target = logger.head;
+    while (logger.running && logger.flushed < target)
+        pthread_cond_wait(&logger.drained, &logger.lock);
+    pthread_mutex_unlock(&logger.lock);
+}
+
+/**
+ * Wait until the messages logged by a crawl are written out, and stop the
+ * background writer once no other crawl is running. Messages logged
+ * afterwards are written out directly.
+ */
+static void log_stop(void) {
+    log_flush();
+    pthread_mutex_lock(&logger.lock);
+    if (--logger.crawls > 0 || !logger.running) {
+        pthread_mutex_unlock(&logger.lock);
+        return;
+    }
+    logger.stopping = true;
+    pthread_t writer = logger.writer;
+    pthread_cond_signal(&logger.ready);
+    pthread_mutex_unlock(&logger.lock);
+
+    pthread_join(writer, NULL);
+}
+
+/**
+ * Format the current local time, which is only recomputed once the second
+ * changes since the previous call.
+ * 
+ * @return timestamp in the format "YYYY-MM-DD hh:mm:ss"
+ */
+static char *log_timestamp(void) {
+    static __thread time_t cached = -1;
+    static __thread char timestamp[32];
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+    if (ts.tv_sec != cached) {
+        struct tm timeinfo;
+        localtime_r(&ts.tv_sec, &timeinfo);
+        strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", &timeinfo);
+        cached = ts.tv_sec;
+    }
+
+    return timestamp;
+}
+
+/**
+ * Give up the crawl of the current server once a connection fails. The items
+ * indexed so far are kept, and the failure of a single server fails the
+ * crawl while one of several servers leaves the others to be crawled.
+ */
+static void server_unreachable(void) {
+    if (!current->unreachable)
+        log_message(context->multi_server ? LOG_ERROR : LOG_FATAL, stderr,
+                    "Error: Connection failed\n");
+    current->unreachable = true;
+    current->queue.head = current->queue.tail;
+    current->files.head = current->files.tail;
+}
+
+/**
+ * Give up the crawl of the current server on an error of the client itself,
+ * such as running out of memory, which fails the crawl instead of ending the
+ * process. Nothing more is requested, and no report is evaluated.
+ */
+static void server_failed(void) {
+    current->failed = true;
+    current->queue.head = current->queue.tail;
+    current->files.head = current->files.tail;
+    current->retries.count = 0;
+}
+
+/**
+ * Fail the crawl of the current server once memory cannot be allocated,
+ * logging only the first failure. Outside of the crawl of a server, e.g. when
+ * a server is added, the failure is only logged.
+ */
+static void memory_failed(void) {
+    if (current == NULL || !current->failed)
+        log_message(LOG_FATAL, stderr, "Error: Memory allocation failed\n");
+    if (current != NULL) server_failed();
+}
+
+/**
+ * Index the Gopher server by fetching directory indices from the frontier
+ * queue, keeping up to `concurrency` requests in flight at once.
+ * 
+ * Each request is a non-blocking connection driven by an epoll event loop.
+ * Subdirectories found by index_line() are pushed to the frontier queue, so
+ * the traversal is a breadth-first search of the filesystem, or depth-first
+ * with `--order depth`.
+ * 
+ * Text and binary files are pushed to a second queue and their sizes are
+ * evaluated by the same event loop. Directories take precedence unless
+ * `--order files`, but slots not needed by the crawl evaluate file sizes
+ * while the directories are still being discovered. The crawl stops
+ * requesting at `--max-requests` or `--time-budget`, leaving what is queued
+ * unrequested. The results are stored in the entries for evaluate().
+ */
+static void crawl(void) {
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1) {
+        log_message(LOG_FATAL, stderr, "Error: Event loop creation failed\n");
+        server_failed();
+        release_frontier();
+        return;
+    }
+
+    frontier *queue = &current->queue;
+    frontier *files = &current->files;
+    retry_queue *retries = &current->retries;
+    checkpoint_log *checkpoint = &current->checkpoint;
+    rate_limiter *limiter = &current->limiter;
+    deadline_heap *timers = &current->timers;
+    timers->conns = malloc(options->concurrency * sizeof(connection *));
+    timers->count = 0;
+    limiter->window = options->concurrency < INITIAL_WINDOW
+                      ? options->concurrency : INITIAL_WINDOW;
+    limiter->peak = limiter->window;
+    limiter->tokens = options->rate_limit > 1 ? options->rate_limit : 1;
+    limiter->refilled = monotonic_ms();
+
+    // Each slot holds the state of one request and a buffer for its response
+    connection *connections = calloc(options->concurrency, sizeof(connection));
+    bool allocated = timers->conns != NULL && connections != NULL;
+    for (int i = 0; allocated && i < options->concurrency; i++) {
+        connections[i].buffer = malloc(BUFFER_SIZE + 2);
+        connections[i].state = CONN_IDLE;
+        connections[i].slot = UNSCHEDULED;
+        allocated = connections[i].buffer != NULL;
+    }
+    if (!allocated) {
+        memory_failed();
+        for (int i = 0; connections != NULL && i < options->concurrency; i++)
+            free(connections[i].buffer);
+        free(connections);
+        free(timers->conns);
+        timers->conns = NULL;
+        release_frontier();
+        close(epoll_fd);
+        return;
+    }
+
+    current->stop = NO_DEADLINE;
+    if (options->time_budget > 0)
+        current->stop = monotonic_ms()
+                        + (long long)(options->time_budget * 1000);
+
+    struct epoll_event events[MAX_EVENTS];
+    for (;;) {
+        // Once the size budget is spent, the files left are not requested
+        if (budget_spent())
+            while (files->head != files->tail) skip_file(frontier_pop(files));
+        // Nor is anything once a limit of the crawl is reached
+        if (!within_limits()) drop_frontier();
+
+        int active = 0;
+        for (int i = 0; i < options->concurrency; i++)
+            if (connections[i].state != CONN_IDLE) active++;
+
+        // Start requests for queued directories/files in idle slots, as many
+        // as the window and the rate limit of the server allow. Retries take
+        // precedence once due, as they have waited the longest.
+        long long now = monotonic_ms();
+        long long next_deadline = NO_DEADLINE;
+        for (int i = 0; i < options->concurrency; i++) {
+            connection *conn = &connections[i];
+            bool due = retries->count > 0 && retries->entries[0].due <= now;
+            bool queued = due || queue->head != queue->tail
+                          || files->head != files->tail;
+            if (conn->state != CONN_IDLE || !queued) continue;
+            if (active >= (int)limiter->window || current->racer != NULL)
+                break;
+            if (!within_limits()) {
+                drop_frontier();
+                break;
+            }
+            if (!take_token(now)) {
+                next_deadline = next_token();
+                break;
+            }
+            size_t item;
+            if (due) {
+                retry_entry retry = retry_pop(retries);
+                if (retry.job == JOB_SIZE && budget_spent())
+                    skip_file(retry.item);
+                else
+                    connection_open(conn, retry.job, retry.item,
+                                    retry.attempts, epoll_fd);
+            }
+            else {
+                int job = schedule_next(&item);
+                if (job == JOB_NONE) break;
+                connection_open(conn, job, item, 0, epoll_fd);
+            }
+            if (conn->state != CONN_IDLE) active++;
+        }
+
+        // Requests waiting to be retried keep the crawl going until due, or
+        // until the time budget runs out
+        if (retries->count > 0) {
+            long long due = retries->entries[0].due;
+            if (current->stop != NO_DEADLINE && current->stop < due)
+                due = current->stop;
+            if (next_deadline == NO_DEADLINE || due < next_deadline)
+                next_deadline = due;
+        }
+
+        // The crawl is complete once nothing is queued or in flight
+        if (active == 0 && next_deadline == NO_DEADLINE) break;
+
+        // Sleep until the earliest deadline of the requests in flight
+        if (timers->count > 0 && (next_deadline == NO_DEADLINE
+                || timers->conns[0]->deadline < next_deadline))
+            next_deadline = timers->conns[0]->deadline;
+        if (checkpoint->length > 0 && (next_deadline == NO_DEADLINE
+                || checkpoint->next < next_deadline))
+            next_deadline = checkpoint->next;
+        int wait = (int)(next_deadline - monotonic_ms());
+        if (next_deadline == NO_DEADLINE) wait = -1;
+        else if (wait < 0) wait = 0;
+        int ready = epoll_wait(epoll_fd, events, MAX_EVENTS, wait);
+        if (ready == -1 && errno != EINTR) {
+            log_message(LOG_FATAL, stderr, "Error: Event loop failed\n");
+            server_failed();
+            break;
+        }
+        for (int i = 0; i < ready; i++) {
+            // The attempts of a race are told apart from connections
+            if (events[i].data.ptr != &current->race)
+                connection_handle(events[i].data.ptr, epoll_fd);
+            else if (current->racer != NULL)
+                race_advance(current->racer, epoll_fd);
+        }
+
+        // Record requests which the server failed to answer in time
+        now = monotonic_ms();
+        while (timers->count > 0 && timers->conns[0]->deadline <= now) {
+            connection *conn = timers->conns[0];
+            if (conn->state == CONN_RACING) race_advance(conn, epoll_fd);
+            else connection_timeout(conn);
+        }
+
+        // Save the progress of the crawl every CHECKPOINT_INTERVAL
+        if (checkpoint->length > 0 && now >= checkpoint->next)
+            flush_checkpoint(true);
+    }
+
+    // Requests still in flight if the event loop failed are dropped
+    if (current->racer != NULL) race_abandon(current->racer);
+    for (int i = 0; i < options->concurrency; i++) {
+        connection *conn = &connections[i];
+        if (conn->state != CONN_IDLE) {
+            if (conn->fd != -1) close(conn->fd);
+            free(conn->request);
+        }
+        free(conn->buffer);
+        free(conn->cache);
+    }
+    free(connections);
+    free(timers->conns);
+    timers->conns = NULL;
+    release_frontier();
+    close(epoll_fd);
+}
+
+/**
+ * Take a token from the bucket of the current server to start a request,
+ * after refilling it at `rate_limit` tokens per second. The bucket holds up to
+ * one second of requests, so bursts are bounded as well as the mean rate.
+ * 
+ * @param now monotonic time in milliseconds
+ * @return whether a request may be started
+ */
+static bool take_token(long long now) {
+    if (options->rate_limit <= 0) return true;
+
+    rate_limiter *limiter = &current->limiter;
+    double capacity = options->rate_limit > 1 ? options->rate_limit : 1;
+    limiter->tokens += (now - limiter->refilled) * options->rate_limit / 1000;
+    if (limiter->tokens > capacity) limiter->tokens = capacity;
+    limiter->refilled = now;
+    if (limiter->tokens < 1) return false;
+    limiter->tokens--;
+    return true;
+}
+
+/**
+ * @return monotonic time (ms) at which the bucket of the current server holds
+ *         a token again
+ */
+static long long next_token(void) {
+    rate_limiter *limiter = &current->limiter;
+    return limiter->refilled
+           + (long long)((1 - limiter->tokens) * 1000 / options->rate_limit)
+           + 1;
+}
+
+/**
+ * Widen the window of the current server by one request per window of
+ * requests answered, up to `concurrency`.
+ */
+static void grow_window(void) {
+    rate_limiter *limiter = &current->limiter;
+    limiter->window += 1 / limiter->window;
+    if (limiter->window > options->concurrency)
+        limiter->window = options->concurrency;
+    if ((int)limiter->window > limiter->peak)
+        limiter->peak = limiter->window;
+}
+
+/**
+ * Halve the window of the current server after a request timed out. The
+ * requests started before the previous reduction are already accounted for,
+ * so a burst of timeouts halves the window only once.
+ * 
+ * @param timing timestamps of the request which timed out
+ */
+static void shrink_window(request_timing *timing) {
+    rate_limiter *limiter = &current->limiter;
+    if (timing->started <= limiter->reduced) return;
+    limiter->window /= 2;
+    if (limiter->window < MIN_WINDOW) limiter->window = MIN_WINDOW;
+    limiter->reductions++;
+    limiter->reduced = monotonic_us();
+    log_message(LOG_DEBUG, stdout, "Requests in flight reduced to %d\n",
+                (int)limiter->window);
+}
+
+/**
+ * Work out when a request expires from the timeouts of its phase. Once the
+ * response has started, each packet has to follow the previous one within the
+ * idle timeout, and the whole response has to arrive within the transfer
+ * timeout of its first byte, whichever expires first.
+ * 
+ * @param phase PHASE_CRAWL, PHASE_SIZE or PHASE_EXTERNAL
+ * @param stage DEADLINE_CONNECT, DEADLINE_FIRST_BYTE or DEADLINE_IDLE
+ * @param since monotonic time (ms) the stage started, or of the last packet
+ * @param first_byte monotonic time (ms) of the first byte of the response
+ * @return monotonic time (ms) of the deadline, NO_DEADLINE if unlimited
+ */
+static long long request_deadline(int phase, int stage, long long since,
+                                  long long first_byte) {
+    const int *limits = options->timeouts[phase];
+    long long deadline = limits[stage] > 0 ? since + limits[stage]
+                                           : NO_DEADLINE;
+    if (stage == DEADLINE_IDLE && limits[DEADLINE_TRANSFER] > 0) {
+        long long transfer = first_byte + limits[DEADLINE_TRANSFER];
+        if (deadline == NO_DEADLINE || transfer < deadline)
+            deadline = transfer;
+    }
+
+    return deadline;
+}
+
+/**
+ * Set the deadline of a connection from its stage and move it to its place
+ * in the deadline heap of the current server, inserting it if need be.
+ * 
+ * @param conn connection in flight
+ */
+static void schedule_deadline(connection *conn) {
+    int phase = conn->job == JOB_INDEX ? PHASE_CRAWL : PHASE_SIZE;
+    int stage = DEADLINE_CONNECT;
+    if (conn->state != CONN_CONNECTING && conn->state != CONN_RACING)
+        stage = conn->received == 0 ? DEADLINE_FIRST_BYTE : DEADLINE_IDLE;
+    conn->deadline = request_deadline(phase, stage, conn->since,
+                                      conn->timing.first_byte / 1000);
+    // A race also wakes up when its next attempt is due
+    address_race *race = &current->race;
+    if (conn->state == CONN_RACING && race->started < race->count
+            && (conn->deadline == NO_DEADLINE || race->next < conn->deadline))
+        conn->deadline = race->next;
+    if (conn->deadline == NO_DEADLINE) {
+        cancel_deadline(conn);
+        return;
+    }
+
+    deadline_heap *timers = &current->timers;
+    if (conn->slot == UNSCHEDULED) {
+        conn->slot = timers->count;
+        timers->conns[timers->count++] = conn;
+    }
+    sift_deadline(conn->slot);
+}
+
+/**
+ * Remove a connection from the deadline heap of the current server.
+ * 
+ * @param conn connection, scheduled or not
+ */
+static void cancel_deadline(connection *conn) {
+    deadline_heap *timers = &current->timers;
+    size_t slot = conn->slot;
+    if (slot == UNSCHEDULED) return;
+
+    // Fill the hole with the last connection and restore the heap order
+    swap_deadlines(slot, --timers->count);
+    conn->slot = UNSCHEDULED;
+    if (slot < timers->count) sift_deadline(slot);
+}
+
+/**
+ * Move a connection up or down the deadline heap until its deadline is no
+ * earlier than that of its parent and no later than those of its children.
+ * 
+ * @param slot position of the connection in the heap
+ */
+static void sift_deadline(size_t slot) {
+    deadline_heap *timers = &current->timers;
+    connection **conns = timers->conns;
+    while (slot > 0
+            && conns[slot]->deadline < conns[(slot - 1) / 2]->deadline) {
+        swap_deadlines(slot, (slot - 1) / 2);
+        slot = (slot - 1) / 2;
+    }
+    for (;;) {
+        size_t child = 2 * slot + 1;
+        if (child >= timers->count) break;
+        if (child + 1 < timers->count
+                && conns[child + 1]->deadline < conns[child]->deadline)
+            child++;
+        if (conns[slot]->deadline <= conns[child]->deadline) break;
+        swap_deadlines(slot, child);
+        slot = child;
+    }
+}
+
+/**
+ * Swap two connections of the deadline heap, keeping their positions.
+ * 
+ * @param a position of the first connection
+ * @param b position of the second connection
+ */
+static void swap_deadlines(size_t a, size_t b) {
+    connection **conns = current->timers.conns;
+    connection *conn = conns[a];
+    conns[a] = conns[b];
+    conns[b] = conn;
+    conns[a]->slot = a;
+    conns[b]->slot = b;
+}
+
+/**
+ * Wait for a blocking request to be able to proceed on its socket. The time
+ * left is worked out again after every interruption, so the deadline holds
+ * however many times the wait is resumed.
+ * 
+ * @param sock socket file descriptor
+ * @param events POLLIN to receive, POLLOUT to connect/send
+ * @param deadline monotonic time (ms) of the deadline, or NO_DEADLINE
+ * @return whether the socket is ready before the deadline
+ */
+static bool wait_socket(int sock, short events, long long deadline) {
+    for (;;) {
+        int wait = -1;
+        if (deadline != NO_DEADLINE) {
+            long long remaining = deadline - monotonic_ms();
+            wait = remaining > 0 ? (int)remaining : 0;
+        }
+        struct pollfd fd = {sock, events, 0};
+        int ready = poll(&fd, 1, wait);
+        if (ready == -1 && errno == EINTR) continue;
+        return ready > 0;
+    }
+}
+
+/**
+ * Set a timeout given as "[<phase>.]<deadline>=<milliseconds>", where the
+ * phase is "crawl", "size" or "external" (all of them if omitted), and the
+ * deadline is "connect", "first-byte", "idle" or "transfer". A timeout of 0
+ * disables the deadline.
+ * 
+ * @param options options of the crawl
+ * @param spec timeout given to the option
+ * @return whether the timeout is valid
+ */
+bool gopher_parse_timeout(gopher_options *options, const char *spec) {
+    char *phases[NUM_OF_PHASES] = {"crawl", "size", "external"};
+    char *deadlines[NUM_OF_DEADLINES] = {"connect", "first-byte", "idle",
+                                         "transfer"};
+    const char *value = strchr(spec, '=');
+    if (value == NULL) return false;
+    char *end;
+    long milliseconds = strtol(value + 1, &end, 10);
+    if (end == value + 1 || *end != '\0' || milliseconds < 0
+            || milliseconds > INT_MAX)
+        return false;
+
+    int phase = -1;
+    const char *deadline = spec;
+    const char *dot = memchr(spec, '.', value - spec);
+    if (dot != NULL) {
+        for (int i = 0; i < NUM_OF_PHASES; i++) {
+            if (strlen(phases[i]) == (size_t)(dot - spec)
+                    && strncmp(spec, phases[i], dot - spec) == 0)
+                phase = i;
+        }
+        if (phase == -1) return false;
+        deadline = dot + 1;
+    }
+    for (int d = 0; d < NUM_OF_DEADLINES; d++) {
+        if (strlen(deadlines[d]) != (size_t)(value - deadline)
+                || strncmp(deadline, deadlines[d], value - deadline) != 0)
+            continue;
+        for (int i = 0; i < NUM_OF_PHASES; i++)
+            if (phase == -1 || phase == i)
+                options->timeouts[i][d] = milliseconds;
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * Include entries of types which are not indexed by default, given as a
+ * comma-separated list of "search" (full-text search servers) and "links"
+ * (URL links).
+ * 
+ * @param options options of the crawl
+ * @param spec types given to the option
+ * @return whether all the types are valid
+ */
+bool gopher_parse_include(gopher_options *options, const char *spec) {
+    for (const char *kind = spec; ; ) {
+        char *comma = strchr(kind, ',');
+        size_t length = comma != NULL ? (size_t)(comma - kind) : strlen(kind);
+        if (length == 6 && strncmp(kind, "search", 6) == 0)
+            options->include_search = true;
+        else if (length == 5 && strncmp(kind, "links", 5) == 0)
+            options->include_links = true;
+        else return false;
+        if (comma == NULL) return true;
+        kind = comma + 1;
+    }
+}
+
+/**
+ * Start a non-blocking request for a directory index or a file in an idle
+ * slot.
+ * 
+ * @param conn idle connection slot
+ * @param job JOB_INDEX for a directory, JOB_SIZE for a file
+ * @param item position of the directory/file in the entry store
+ * @param attempts retries of the request made before, 0 if none
+ * @param epoll_fd file descriptor of the event loop
+ */
+static void connection_open(connection *conn, int job, size_t item,
+                            int attempts, int epoll_fd) {
+    // Append "\r\n" to the end of the path to form a request line
+    char *record = current->store.records[item];
+    size_t path_length = strlen(record);
+    conn->request = malloc(path_length + 3);
+
+    // The content of text files is cached in case it is to be printed
+    bool caching = job == JOB_SIZE && current->store.types[item] == TEXT
+                   && options->cache_limit > 0;
+    if (caching && conn->cache == NULL)
+        conn->cache = malloc(options->cache_limit + 1);
+    if (conn->request == NULL || (caching && conn->cache == NULL)) {
+        free(conn->request);
+        conn->request = NULL;
+        memory_failed();
+        return;
+    }
+    memcpy(conn->request, record, path_length);
+    conn->request[path_length] = '\r';
+    conn->request[path_length + 1] = '\n';
+    conn->request[path_length + 2] = '\0';
+    conn->request_length = path_length + 2;
+
+    // Initiate the connection, which completes once the socket is writable
+    conn->job = job;
+    conn->item = item;
+    conn->attempts = attempts;
+    current->requests++;
+    memset(&conn->timing, 0, sizeof(request_timing));
+    conn->timing.started = monotonic_us();
+    address_race *race = &current->race;
+    conn->fd = -1;
+    conn->sent = 0;
+    if (server_address(race) && race->count == 0)
+        conn->fd = server_socket(SOCK_NONBLOCK,
+                                 job == JOB_SIZE ? SIZE_RCVBUF : 0,
+                                 conn->request, conn->request_length,
+                                 &conn->sent);
+    if (conn->fd == -1 && race->count == 0) {
+        conn->timing.failed = true;
+        connection_failed(conn);
+        return;
+    }
+
+    conn->length = 0;
+    conn->received = 0;
+    conn->overflow = false;
+    conn->timed_out = false;
+    conn->cached = 0;
+    conn->hash = context->index_seed;
+    if (job == JOB_SIZE && options->hash_files) content_start(&conn->content);
+    conn->matched = 0;
+    conn->saved = NULL;
+    if (job == JOB_INDEX) {
+        // An index which may be unchanged is only parsed if it has changed
+        index_record *saved = find_saved(DIRECTORY, record);
+        if (saved != NULL && saved->hash != 0) conn->saved = saved;
+    }
+    conn->since = monotonic_ms();
+
+    if (race->count > 0) {
+        race_start(conn, epoll_fd);
+        return;
+    }
+    conn->state = CONN_CONNECTING;
+    schedule_deadline(conn);
+    struct epoll_event event;
+    event.events = EPOLLOUT;
+    event.data.ptr = conn;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, conn->fd, &event);
+}
+
+/**
+ * Advance the state machine of a connection reported ready by epoll.
+ * 
+ * @param conn connection with a pending event
+ * @param epoll_fd file descriptor of the event loop
+ */
+static void connection_handle(connection *conn, int epoll_fd) {
+    if (conn->state == CONN_CONNECTING) {
+        int so_error;
+        socklen_t len = sizeof so_error;
+        getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &so_error, &len);
+        if (so_error != 0) {
+            connection_failed(conn);
+            return;
+        }
+        conn->state = CONN_SENDING;
+        conn->timing.connected = monotonic_us();
+    }
+
+    if (conn->state == CONN_SENDING) {
+        // Send the request line, possibly over several writable events
+        ssize_t bytes_sent = send(conn->fd, conn->request + conn->sent,
+                                  conn->request_length - conn->sent,
+                                  MSG_NOSIGNAL);
+        if (bytes_sent == -1) {
+            if (errno == EWOULDBLOCK || errno == EAGAIN) return;
+            log_message(LOG_ERROR, stderr, "Error: Unable to send request\n");
+            if (conn->received == 0) {
+                connection_failed(conn);
+                return;
+            }
+            if (conn->job == JOB_SIZE)
+                current->store.sizes[conn->item] = SIZE_FAILED;
+            conn->timing.failed = true;
+            connection_complete(conn);
+            return;
+        }
+        conn->sent += bytes_sent;
+        if (conn->sent < conn->request_length) return;
+
+        log_request(conn->request);
+        conn->state = CONN_RECEIVING;
+        conn->since = monotonic_ms();
+        schedule_deadline(conn);
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = conn;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn->fd, &event);
+        return;
+    }
+
+    // Read whatever has arrived until the socket would block. The complete
+    // lines of a directory index are indexed as soon as they are received,
+    // whereas the bytes of a file are only counted (and possibly cached).
+    size_t received = conn->received;
+    for (;;) {
+        size_t room = BUFFER_SIZE - conn->length;
+        size_t wanted = room;
+        size_t taken = 0;
+        if (conn->job == JOB_SIZE) {
+            // A file is measured up to the file limit, and within the bytes
+            // taken from the size budget shared by all files in flight
+            wanted = options->file_limit - conn->received;
+            if (options->size_budget > 0) wanted = taken = take_budget(wanted);
+            if (wanted == 0) {
+                abort_connection(conn->fd);
+                current->store.sizes[conn->item] = SIZE_SKIPPED;
+                connection_complete(conn);
+                return;
+            }
+            if (wanted < room) room = wanted;
+        }
+        ssize_t bytes_received = -1;
+        bool discard = false;
+#ifdef MSG_TRUNC
+        // Bytes which are neither cached nor hashed are discarded by the
+        // kernel uncopied
+        discard = conn->job == JOB_SIZE && discard_in_kernel
+                  && !options->hash_files
+                  && (conn->cache == NULL || conn->cached < conn->received
+                      || current->store.types[conn->item] != TEXT);
+        if (discard) {
+            bytes_received = recv(conn->fd, NULL, wanted, MSG_TRUNC);
+            // Fall back to copying if unsupported by the protocol or system
+            if (bytes_received == -1 && (errno == EINVAL || errno == EFAULT
+                                         || errno == EOPNOTSUPP)) {
+                discard_in_kernel = false;
+                atomic_fetch_add(&context->budget, taken);
+                continue;
+            }
+        }
+#endif
+        if (!discard)
+            bytes_received = recv(conn->fd, conn->buffer + conn->length, room,
+                                  0);
+        // Bytes taken but not received are returned to the budget
+        if (taken > 0)
+            atomic_fetch_add(&context->budget, bytes_received > 0
+                             ? taken - bytes_received : taken);
+        if (bytes_received == -1) {
+            if (errno == EWOULDBLOCK || errno == EAGAIN) break;
+            log_message(LOG_ERROR, stderr,
+                        "Error: Unable to receive server response\n");
+            if (conn->received == 0) {
+                connection_failed(conn);
+                return;
+            }
+            if (conn->job == JOB_SIZE)
+                current->store.sizes[conn->item] = SIZE_FAILED;
+            conn->timing.failed = true;
+            connection_complete(conn);
+            return;
+        }
+
+        // The server terminates the connection at the end of the response
+        if (bytes_received == 0) {
+            connection_complete(conn);
+            return;
+        }
+        if (conn->received == 0) conn->timing.first_byte = monotonic_us();
+
+        if (conn->job == JOB_INDEX) {
+            char *data = conn->buffer + conn->length;
+            if (options->index_path != NULL)
+                conn->hash = hash_bytes(conn->hash, data, bytes_received);
+            conn->received += bytes_received;
+            conn->length += bytes_received;
+            index_response(conn, false);
+            continue;
+        }
+
+        // Keep the bytes received while the file still fits in the cache
+        if (conn->cache != NULL && current->store.types[conn->item] == TEXT
+                && conn->cached == conn->received
+                && conn->cached + bytes_received <= options->cache_limit) {
+            memcpy(conn->cache + conn->cached, conn->buffer, bytes_received);
+            conn->cached += bytes_received;
+        }
+        if (options->hash_files)
+            content_update(&conn->content, conn->buffer, bytes_received);
+        conn->received += bytes_received;
+
+        // Stop evaluation if file is too large, without reading the rest
+        if (conn->received >= options->file_limit) {
+            abort_connection(conn->fd);
+            current->store.sizes[conn->item] = SIZE_TOO_LARGE;
+            connection_complete(conn);
+            return;
+        }
+    }
+
+    // Every packet defers the deadline, up to that of the whole transfer
+    if (conn->received > received) {
+        conn->since = monotonic_ms();
+        schedule_deadline(conn);
+    }
+}
+
+/**
+ * Record a request which the server failed to answer in time and reset the
+ * connection. The directory index received so far is still indexed, whereas
+ * the file size is unknown. A connection not established in time has failed
+ * instead.
+ * 
+ * @param conn connection whose deadline has passed
+ */
+static void connection_timeout(connection *conn) {
+    // A connection never established fails like a refused one, and is retried
+    if (conn->state == CONN_CONNECTING) {
+        connection_failed(conn);
+        return;
+    }
+    log_message(LOG_ERROR, stderr, "Error: Server response timeout\n");
+    index_item(TIMEOUT, conn->request);
+    conn->timing.failed = true;
+    conn->timed_out = true;
+    shrink_window(&conn->timing);
+    abort_connection(conn->fd);
+    if (conn->job == JOB_SIZE) current->store.sizes[conn->item] = SIZE_FAILED;
+    connection_complete(conn);
+}
+
+/**
+ * Release a connection whose request failed before anything was received.
+ * The request is queued to be retried, unless it has been retried
+ * `max_retries` times already, in which case the directory/file is recorded
+ * as an issue and the crawl goes on without it.
+ * 
+ * @param conn connection which failed to connect, send or receive
+ */
+static void connection_failed(connection *conn) {
+    // A request never opened has neither a deadline nor metrics to record
+    if (conn->state != CONN_IDLE) {
+        cancel_deadline(conn);
+        if (conn->fd != -1) close(conn->fd);
+        conn->state = CONN_IDLE;
+        conn->timing.failed = true;
+        record_request(conn->job == JOB_INDEX ? PHASE_CRAWL : PHASE_SIZE,
+                       &conn->timing);
+    }
+
+    if (!retry_request(conn)) {
+        index_item(CONNECT_FAILED, conn->request);
+        if (conn->job == JOB_SIZE)
+            current->store.sizes[conn->item] = SIZE_FAILED;
+        output_item(conn->item, OUTPUT_FAILED, -1,
+                    monotonic_us() - conn->timing.started);
+        // Nothing can be crawled without the root directory
+        if (conn->item == ROOT) server_unreachable();
+    }
+
+    free(conn->request);
+    conn->request = NULL;
+}
+
+/**
+ * Queue a failed request to be retried after an exponential backoff with
+ * jitter, RETRY_DELAY doubled for every retry before, of which a random half
+ * is waived so that the retries of simultaneous failures are spread out.
+ * 
+ * @param conn connection whose request failed
+ * @return true if the request is retried, false if out of retries
+ */
+static bool retry_request(connection *conn) {
+    if (conn->attempts >= options->max_retries) return false;
+
+    long long delay = (long long)RETRY_DELAY << conn->attempts;
+    delay = delay / 2 + rand_r(&current->jitter) % (delay / 2 + 1);
+    retry_entry entry = {conn->item, conn->job, conn->attempts + 1,
+                         monotonic_ms() + delay};
+    retry_push(&current->retries, entry);
+    log_message(LOG_ERROR, stderr,
+                "Error: Connection failed, retrying in %lld ms: %s", delay,
+                conn->request);
+    return true;
+}
+
+/**
+ * Terminate a connection, index the directory or record the size of the file
+ * received and release the slot.
+ * 
+ * @param conn connection whose response is complete
+ */
+static void connection_complete(connection *conn) {
+    // Closing the socket also removes it from the event loop
+    cancel_deadline(conn);
+    close(conn->fd);
+    conn->state = CONN_IDLE;
+    conn->timing.bytes = conn->received;
+    record_request(conn->job == JOB_INDEX ? PHASE_CRAWL : PHASE_SIZE,
+                   &conn->timing);
+    if (!conn->timing.failed) grow_window();
+    log_message(LOG_DEBUG, stdout, "Response of %zu bytes in %.3f ms: %s",
+                conn->received,
+                (monotonic_us() - conn->timing.started) / 1000.0,
+                conn->request);
+
+    current->store.checked[conn->item] = time(NULL);
+    if (conn->job == JOB_INDEX && !conn->timing.failed)
+        current->store.hashes[conn->item] = conn->hash;
+
+    if (conn->job == JOB_SIZE)
+        record_file_size(conn);
+    // Handle an empty string response from the server
+    else if (conn->received == 0)
+        log_message(LOG_INFO, stdout, "Empty response from the server\n");
+    else {
+        index_response(conn, true);
+        // An unchanged index lists the items it listed in the previous crawl
+        if (conn->saved != NULL && !conn->timing.failed
+                && conn->matched == conn->saved->num_of_links
+                && conn->hash == conn->saved->hash)
+            replay_directory(conn->item, conn->saved);
+        else if (conn->saved != NULL) index_matched(conn);
+    }
+
+    // A directory is only complete once all the items it lists are indexed
+    if (conn->job == JOB_INDEX)
+        log_checkpoint(CHECKPOINT_DONE, conn->item,
+                       current->store.checked[conn->item]);
+
+    int status = OUTPUT_OK;
+    ssize_t size = conn->received;
+    if (conn->job == JOB_SIZE) size = current->store.sizes[conn->item];
+    if (conn->timed_out) status = OUTPUT_TIMEOUT;
+    else if (size == SIZE_TOO_LARGE) status = OUTPUT_TOO_LARGE;
+    else if (size == SIZE_SKIPPED) status = OUTPUT_SKIPPED;
+    else if (conn->timing.failed) status = OUTPUT_FAILED;
+    // A file stopped short is output with the bytes received, a lower bound
+    if (status == OUTPUT_TOO_LARGE || status == OUTPUT_SKIPPED)
+        size = conn->received;
+    output_item(conn->item, status, size < 0 ? -1 : size,
+                monotonic_us() - conn->timing.started);
+
+    free(conn->request);
+    conn->request = NULL;
+}
+
+/**
+ * Store the size of a file whose transfer has ended. The cache
+ * of a text file replaces that of the smallest text file if it is smaller, or
+ * equally small and indexed earlier, so that the file chosen is the same
+ * regardless of the order in which the transfers finish.
+ * 
+ * @param conn connection which received the file
+ */
+static void record_file_size(connection *conn) {
+    entry_store *store = &current->store;
+    file_cache *smallest = &current->smallest;
+    size_t item = conn->item;
+    if (store->sizes[item] == SIZE_TOO_LARGE) {
+        log_message(LOG_ERROR, stderr, "The file %s is too large\n",
+                    store->records[item]);
+        // The sample is logged first, so that a streamed listing has it
+        sample_log *log = &current->samples;
+        if (find_item(TOO_LARGE, store->records[item]) == ROOT) {
+            if (log->count == log->capacity) {
+                size_t capacity = log->capacity > 0 ? log->capacity * 2 : 64;
+                file_sample *samples = realloc(log->samples,
+                        capacity * sizeof(file_sample));
+                if (samples == NULL) {
+                    memory_failed();
+                    return;
+                }
+                log->samples = samples;
+                log->capacity = capacity;
+            }
+            file_sample *sample = &log->samples[log->count++];
+            sample->item = store->count;
+            sample->bytes = conn->received;
+            sample->duration = monotonic_us() - conn->timing.first_byte;
+        }
+        index_item(TOO_LARGE, store->records[item]);
+        log_checkpoint(CHECKPOINT_SIZE, item, SIZE_TOO_LARGE);
+        return;
+    }
+    if (store->sizes[item] == SIZE_SKIPPED) {
+        current->skipped++;
+        return;
+    }
+    if (store->sizes[item] == SIZE_FAILED) return;
+
+    store->sizes[item] = conn->received;
+    log_checkpoint(CHECKPOINT_SIZE, item, store->sizes[item]);
+    tally_size(item);
+    if (options->hash_files) {
+        store->hashes[item] = content_digest(&conn->content);
+        log_checkpoint(CHECKPOINT_HASH, item, (int64_t)store->hashes[item]);
+    }
+    if (conn->received == 0)
+        log_message(LOG_INFO, stdout, "No response from the server\n");
+
+    // Keep the cache if it holds the entire file and swap in the old buffer
+    if (store->types[item] != TEXT || conn->cache == NULL
+            || conn->cached != conn->received)
+        return;
+    ssize_t size = store->sizes[item];
+    if (smallest->item != ROOT && (size > store->sizes[smallest->item]
+            || (size == store->sizes[smallest->item]
+                && item > smallest->item)))
+        return;
+    char *previous = smallest->data;
+    smallest->data = conn->cache;
+    smallest->length = conn->cached;
+    smallest->item = item;
+    conn->cache = previous;
+}
+
+/**
+ * Leave a file unmeasured once the size budget is spent, without requesting
+ * it. It is not logged to the checkpoint, so a resumed crawl measures it.
+ * 
+ * @param item position of the text/binary file
+ */
+static void skip_file(size_t item) {
+    current->store.sizes[item] = SIZE_SKIPPED;
+    current->skipped++;
+    output_item(item, OUTPUT_SKIPPED, -1, -1);
+}
+
+/**
+ * Take bytes to receive from the size budget, which is shared by the files
+ * of all the servers of the context.
+ * 
+ * @param wanted number of bytes wanted
+ * @return number of bytes taken, 0 once the budget is spent
+ */
+static size_t take_budget(size_t wanted) {
+    long long left = atomic_load(&context->budget);
+    long long taken;
+    do {
+        taken = left < (long long)wanted ? left : (long long)wanted;
+        if (taken <= 0) return 0;
+    } while (!atomic_compare_exchange_weak(&context->budget, &left,
+                                           left - taken));
+    return taken;
+}
+
+/**
+ * @return whether a size budget is set and has been spent by all servers
+ */
+static bool budget_spent(void) {
+    return options->size_budget > 0 && atomic_load(&context->budget) == 0;
+}
+
+/**
+ * Leave a directory uncrawled once beyond the depth or another limit of the
+ * crawl. Like a file skipped, it is crawled if the crawl is resumed.
+ * 
+ * @param item position of the directory
+ */
+static void skip_directory(size_t item) {
+    current->unvisited++;
+    output_item(item, OUTPUT_SKIPPED, -1, -1);
+}
+
+/**
+ * @return whether the crawl may start another request, within
+ *         `--max-requests` and `--time-budget`
+ */
+static bool within_limits(void) {
+    if (options->max_requests > 0
+            && current->requests >= (size_t)options->max_requests)
+        return false;
+    return current->stop == NO_DEADLINE || monotonic_ms() < current->stop;
+}
+
+/**
+ * Leave all the directories and files queued or waiting to be retried
+ * unrequested, once a limit of the crawl is reached.
+ */
+static void drop_frontier(void) {
+    while (current->queue.head != current->queue.tail)
+        skip_directory(frontier_pop(&current->queue));
+    while (current->files.head != current->files.tail)
+        skip_file(frontier_pop(&current->files));
+    while (current->retries.count > 0) {
+        retry_entry retry = retry_pop(&current->retries);
+        if (retry.job == JOB_INDEX) skip_directory(retry.item);
+        else skip_file(retry.item);
+    }
+}
+
+/**
+ * Free the frontier queues and the retry queue of the current server once
+ * its crawl has ended, or has failed before it began.
+ */
+static void release_frontier(void) {
+    free(current->queue.items);
+    free(current->files.items);
+    free(current->retries.entries);
+    memset(&current->queue, 0, sizeof(frontier));
+    memset(&current->files, 0, sizeof(frontier));
+    memset(&current->retries, 0, sizeof(retry_queue));
+}
+
+/**
+ * Take the next directory/file to request from the frontier, in the order
+ * of `--order`. Directories deeper than `--max-depth` are skipped on the way.
+ * 
+ * @param item set to the position of the directory/file
+ * @return JOB_INDEX for a directory, JOB_SIZE for a file, JOB_NONE if both
+ *         queues are empty
+ */
+static int schedule_next(size_t *item) {
+    frontier *queue = &current->queue;
+    frontier *files = &current->files;
+    for (;;) {
+        bool directories = queue->head != queue->tail;
+        if (options->crawl_order == ORDER_FILES && files->head != files->tail)
+            directories = false;
+        if (!directories) {
+            if (files->head == files->tail) return JOB_NONE;
+            *item = frontier_pop(files);
+            return JOB_SIZE;
+        }
+
+        *item = options->crawl_order == ORDER_DEPTH ? frontier_take(queue)
+                                                    : frontier_pop(queue);
+        uint32_t depth = current->store.depths[*item];
+        if (options->max_depth < 0
+                || depth <= (uint32_t)options->max_depth)
+            return JOB_INDEX;
+        skip_directory(*item);
+    }
+}
+
+/**
+ * Look up the sample of a file too large, by binary search as the samples
+ * are logged in the order of the items too large.
+ * 
+ * @param item position of the item too large
+ * @return sample of the file, NULL if stopped in a previous crawl
+ */
+static file_sample *find_sample(size_t item) {
+    sample_log *log = &current->samples;
+    size_t low = 0, high = log->count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (log->samples[middle].item < item) low = middle + 1;
+        else high = middle;
+    }
+    if (low < log->count && log->samples[low].item == item)
+        return &log->samples[low];
+    return NULL;
+}
+
+/**
+ * Index the complete lines of the directory index buffered by a connection.
+ * 
+ * Each line in the directory index is handled by the helper function
+ * index_line(). A partial line at the end of the buffer is moved to the front
+ * and completed by the following recv() calls, so only one line has to be
+ * held in memory however large the directory index is. A line that does not
+ * fit in the buffer is discarded. While the index lists the same items as in
+ * the previous crawl, they are only compared (match_line()), and indexed once
+ * the index turns out to have changed.
+ * 
+ * @param conn connection receiving the directory index
+ * @param final whether the server has terminated the connection
+ */
+static void index_response(connection *conn, bool final) {
+    char *line = conn->buffer;
+    char *end = conn->buffer + conn->length;
+
+    // A response not ending with "\r\n" is still handled gracefully
+    if (final && conn->length > 0) {
+        memcpy(end, "\r\n", 2);
+        end += 2;
+    }
+
+    // The items listed are a level below the directory
+    current->parent = conn->item;
+    menu_line fields;
+    char *next_line;
+    while ((next_line = find_next_line(line, end, &fields)) != NULL) {
+        if (!conn->overflow && (conn->saved == NULL
+                                || !match_line(conn, &fields))) {
+            size_t child = index_line(&fields, conn->request);
+            if (child != ROOT && options->index_path != NULL)
+                log_link(conn->item, child);
+        }
+        conn->overflow = false;
+        line = next_line;
+    }
+
+    if (final) {
+        conn->length = 0;
+        return;
+    }
+
+    size_t rest = end - line;
+    if (rest == BUFFER_SIZE) {
+        // Keep a trailing '\r' which may be followed by '\n' in the next chunk
+        conn->overflow = true;
+        rest = *(end - 1) == '\r' ? 1 : 0;
+        line = end - rest;
+    }
+    memmove(conn->buffer, line, rest);
+    conn->length = rest;
+}
+
+/**
+ * Append a directory/file to a queue, growing the queue if it is full.
+ * 
+ * @param q queue of directories or files
+ * @param item position of the directory/file in the entry store
+ */
+static void frontier_push(frontier *q, size_t item) {
+    if (q->tail == q->capacity) {
+        // Reclaim the space of items already dequeued before growing
+        size_t pending = q->tail - q->head;
+        if (q->head > 0)
+            memmove(q->items, q->items + q->head, pending * sizeof(size_t));
+        q->head = 0;
+        q->tail = pending;
+        if (pending == q->capacity) {
+            size_t capacity = q->capacity == 0 ? 64 : q->capacity * 2;
+            size_t *items = realloc(q->items, capacity * sizeof(size_t));
+            if (items == NULL) {
+                memory_failed();
+                return;
+            }
+            q->items = items;
+            q->capacity = capacity;
+        }
+    }
+    q->items[q->tail++] = item;
+}
+
+/**
+ * Remove the directory/file at the front of a queue.
+ * 
+ * @param q queue of directories or files
+ * @return position of the directory/file, ROOT if the queue is empty
+ */
+static size_t frontier_pop(frontier *q) {
+    if (q->head == q->tail) return ROOT;
+    return q->items[q->head++];
+}
+
+/**
+ * Remove the directory/file at the back of a queue, the one queued last.
+ * 
+ * @param q queue of directories or files
+ * @return position of the directory/file, ROOT if the queue is empty
+ */
+static size_t frontier_take(frontier *q) {
+    if (q->head == q->tail) return ROOT;
+    return q->items[--q->tail];
+}
+
+/**
+ * Insert a request into the retry queue, moving it up the heap until it is
+ * due no earlier than its parent.
+ * 
+ * @param q queue of requests to be retried
+ * @param entry directory/file request and the time it is due
+ */
+static void retry_push(retry_queue *q, retry_entry entry) {
+    if (q->count == q->capacity) {
+        size_t capacity = q->capacity == 0 ? 16 : q->capacity * 2;
+        retry_entry *entries = realloc(q->entries,
+                                       capacity * sizeof(retry_entry));
+        if (entries == NULL) {
+            memory_failed();
+            return;
+        }
+        q->entries = entries;
+        q->capacity = capacity;
+    }
+    size_t slot = q->count++;
+    while (slot > 0 && entry.due < q->entries[(slot - 1) / 2].due) {
+        q->entries[slot] = q->entries[(slot - 1) / 2];
+        slot = (slot - 1) / 2;
+    }
+    q->entries[slot] = entry;
+}
+
+/**
+ * Remove the request due the earliest from a non-empty retry queue, moving
+ * the last request down the heap to fill its place.
+ * 
+ * @param q queue of requests to be retried
+ * @return directory/file request due the earliest
+ */
+static retry_entry retry_pop(retry_queue *q) {
+    retry_entry first = q->entries[0];
+    retry_entry last = q->entries[--q->count];
+    size_t slot = 0;
+    for (;;) {
+        size_t child = 2 * slot + 1;
+        if (child >= q->count) break;
+        if (child + 1 < q->count
+                && q->entries[child + 1].due < q->entries[child].due)
+            child++;
+        if (q->entries[child].due >= last.due) break;
+        q->entries[slot] = q->entries[child];
+        slot = child;
+    }
+    if (q->count > 0) q->entries[slot] = last;
+    return first;
+}
+
+/**
+ * @return milliseconds elapsed on the monotonic clock
+ */
+static long long monotonic_ms(void) {
+    return monotonic_us() / 1000;
+}
+
+/**
+ * @return microseconds elapsed on the monotonic clock
+ */
+static long long monotonic_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * Add a terminated request to the metrics of a phase. Latencies of stages the
+ * request never reached are left out of the corresponding histograms.
+ * 
+ * @param phase PHASE_CRAWL, PHASE_SIZE or PHASE_EXTERNAL
+ * @param timing timestamps and outcome of the request
+ */
+static void record_request(int phase, request_timing *timing) {
+    phase_metrics *m = &current->metrics[phase];
+    long long now = monotonic_us();
+
+    m->requests++;
+    if (timing->failed) m->failures++;
+    m->bytes += timing->bytes;
+    if (m->requests == 1 || timing->started < m->start) m->start = timing->started;
+    if (now > m->end) m->end = now;
+
+    if (timing->connected != 0)
+        record_latency(&m->connect, timing->connected - timing->started);
+    if (timing->first_byte != 0)
+        record_latency(&m->first_byte, timing->first_byte - timing->connected);
+    if (phase != PHASE_EXTERNAL)
+        record_latency(&m->total, now - timing->started);
+}
+
+/**
+ * Add a latency to a histogram.
+ * 
+ * @param h histogram of the latency
+ * @param value latency in microseconds
+ */
+static void record_latency(histogram *h, long long value) {
+    if (value < 0) value = 0;
+    int bucket = value == 0 ? 0 : 64 - __builtin_clzll((uint64_t)value);
+    if (bucket >= LATENCY_BUCKETS) bucket = LATENCY_BUCKETS - 1;
+    h->buckets[bucket]++;
+    h->count++;
+    h->sum += value;
+    if ((uint64_t)value > h->max) h->max = value;
+}
+
+/**
+ * Estimate a percentile of a histogram as the upper bound of the bucket in
+ * which it lies, which is at most twice the actual value.
+ * 
+ * @param h histogram of a latency
+ * @param fraction percentile as a fraction (e.g. 0.99)
+ * @return estimated percentile in microseconds
+ */
+static double latency_percentile(histogram *h, double fraction) {
+    uint64_t rank = (uint64_t)(fraction * h->count + 0.5);
+    if (rank == 0) rank = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen < rank) continue;
+        uint64_t upper = i == 0 ? 0 : (1ULL << i) - 1;
+        return upper < h->max ? upper : h->max;
+    }
+
+    return h->max;
+}
+
+/**
+ * Add the metrics of every phase of a crawl to those of another, as if the
+ * requests of both had been made by a single crawl.
+ * 
+ * @param dest metrics of every phase to add to
+ * @param src metrics of every phase to be added
+ */
+static void merge_metrics(phase_metrics *dest, phase_metrics *src) {
+    for (int i = 0; i < NUM_OF_PHASES; i++) {
+        phase_metrics *d = &dest[i];
+        phase_metrics *m = &src[i];
+        if (m->requests == 0) continue;
+        if (d->requests == 0 || m->start < d->start) d->start = m->start;
+        if (m->end > d->end) d->end = m->end;
+        d->requests += m->requests;
+        d->failures += m->failures;
+        d->bytes += m->bytes;
+        histogram *dh[] = {&d->connect, &d->first_byte, &d->total};
+        histogram *mh[] = {&m->connect, &m->first_byte, &m->total};
+        for (int h = 0; h < 3; h++) {
+            for (int b = 0; b < LATENCY_BUCKETS; b++)
+                dh[h]->buckets[b] += mh[h]->buckets[b];
+            dh[h]->count += mh[h]->count;
+            dh[h]->sum += mh[h]->sum;
+            if (mh[h]->max > dh[h]->max) dh[h]->max = mh[h]->max;
+        }
+    }
+}
+
+/**
+ * Print the metrics of the requests made in every phase of execution.
+ * 
+ * @param out stream of the report
+ * @param metrics metrics of every phase
+ */
+static void print_metrics(FILE *out, phase_metrics *metrics) {
+    char *names[NUM_OF_PHASES] = {"directory indices", "file sizes",
+                                  "external servers"};
+    fprintf(out, "\nRequest metrics:\n");
+    for (int i = 0; i < NUM_OF_PHASES; i++) {
+        phase_metrics *m = &metrics[i];
+        if (m->requests == 0) continue;
+        double seconds = (m->end - m->start) / 1e6;
+        fprintf(out, "Requests for %s: %llu (%llu failed), %llu bytes in "
+                        "%.3f s (%.1f requests/s, %.3f MB/s)\n", names[i],
+                (unsigned long long)m->requests,
+                (unsigned long long)m->failures,
+                (unsigned long long)m->bytes, seconds,
+                seconds > 0 ? m->requests / seconds : 0.0,
+                seconds > 0 ? m->bytes / seconds / 1e6 : 0.0);
+        print_latency(out, "Connect time", &m->connect);
+        print_latency(out, "Time to first byte", &m->first_byte);
+        print_latency(out, "Total time", &m->total);
+    }
+}
+
+/**
+ * Print the summary of a latency histogram in milliseconds.
+ * 
+ * @param out stream of the report
+ * @param name name of the latency
+ * @param h histogram of the latency
+ */
+static void print_latency(FILE *out, char *name, histogram *h) {
+    if (h->count == 0) return;
+    fprintf(out, "    %s (ms): mean %.3f, p50 %.3f, p90 %.3f, "
+                    "p99 %.3f, max %.3f\n", name,
+            (double)h->sum / h->count / 1000,
+            latency_percentile(h, 0.50) / 1000,
+            latency_percentile(h, 0.90) / 1000,
+            latency_percentile(h, 0.99) / 1000, h->max / 1000.0);
+}
+
+/**
+ * Write the metrics of every phase of execution to a JSON file, including
+ * the raw histogram buckets for further analysis.
+ * 
+ * @param path pathname of the JSON file
+ * @param metrics metrics of every phase
+ */
+static void write_metrics(const char *path, phase_metrics *metrics) {
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        log_message(LOG_ERROR, stderr,
+                    "Error: Unable to write metrics to %s\n", path);
+        return;
+    }
+
+    char *names[NUM_OF_PHASES] = {"crawl", "size", "external"};
+    fprintf(file, "{\n");
+    for (int i = 0; i < NUM_OF_PHASES; i++) {
+        phase_metrics *m = &metrics[i];
+        fprintf(file, "  \"%s\": {\"requests\": %llu, \"failures\": %llu, "
+                      "\"bytes\": %llu, \"wall_time_us\": %lld,\n", names[i],
+                (unsigned long long)m->requests,
+                (unsigned long long)m->failures,
+                (unsigned long long)m->bytes, m->end - m->start);
+        write_latency(file, "connect_us", &m->connect, false);
+        write_latency(file, "first_byte_us", &m->first_byte, false);
+        write_latency(file, "total_us", &m->total, true);
+        fprintf(file, "  }%s\n", i + 1 < NUM_OF_PHASES ? "," : "");
+    }
+    fprintf(file, "}\n");
+    fclose(file);
+}
+
+/**
+ * Write a latency histogram as a member of a JSON object.
+ * 
+ * @param file JSON file
+ * @param name name of the member
+ * @param h histogram of the latency
+ * @param last whether it is the last member of the object
+ */
+static void write_latency(FILE *file, char *name, histogram *h, bool last) {
+    fprintf(file, "    \"%s\": {\"count\": %llu, \"mean\": %.1f, "
+                  "\"p50\": %.0f, \"p90\": %.0f, \"p99\": %.0f, "
+                  "\"max\": %llu, \"buckets\": [", name,
+            (unsigned long long)h->count,
+            h->count > 0 ? (double)h->sum / h->count : 0.0,
+            latency_percentile(h, 0.50), latency_percentile(h, 0.90),
+            latency_percentile(h, 0.99), (unsigned long long)h->max);
+    for (int i = 0; i < LATENCY_BUCKETS; i++)
+        fprintf(file, "%s%llu", i > 0 ? ", " : "",
+                (unsigned long long)h->buckets[i]);
+    fprintf(file, "]}%s\n", last ? "" : ",");
+}
+
+/**
+ * A function resembling strtok() using "\r\n" combined (rather than "\r" or
+ * "\n") as the delimiter.
+ * 
+ * The line is split into its tab-separated fields in the same pass, taking
+ * the field boundaries from one mask of the delimiters of every block of
+ * DELIMITER_BLOCK bytes, rather than scanning again after every short field.
+ * Nothing is modified until the "\r\n" is found, so an incomplete line can
+ * be scanned again once the rest of it is received. The delimiters of a
+ * complete line are then replaced with null terminators. A lone '\r' or '\n'
+ * ends the field in which it appears, and fields after the port (e.g.
+ * Gopher+) are ignored.
+ * 
+ * @param ptr pointer to the start of a line
+ * @param end pointer to the end of the bytes received
+ * @param line fields of the line, filled in if the line is complete
+ * @return pointer to the string after "\r\n", NULL if the line is incomplete
+ */
+static char *find_next_line(char *ptr, char *end, menu_line *line) {
+    char *starts[4] = {ptr, NULL, NULL, NULL};  // Type/display, selector, etc.
+    char *ends[4] = {NULL, NULL, NULL, NULL};
+    int fields = 1;
+
+    for (char *block = ptr; block < end; block += DELIMITER_BLOCK) {
+        size_t length = end - block < DELIMITER_BLOCK ? (size_t)(end - block)
+                                                      : DELIMITER_BLOCK;
+        uint32_t mask = delimiter_mask(block, length);
+        for (; mask != 0; mask &= mask - 1) {
+            char *i = block + __builtin_ctz(mask);
+            if (*i == '\r' && i + 1 == end) return NULL;  // "\n" may be due
+            if (*i == '\r' && *(i + 1) == '\n') {
+                if (ends[fields - 1] == NULL) ends[fields - 1] = i;
+                for (int f = 0; f < fields; f++) *ends[f] = '\0';
+                *(i + 1) = '\0';
+
+                line->type = ends[0] > ptr ? ptr[0] : '\0';
+                line->display = ends[0] > ptr ? ptr + 1 : ptr;
+                line->selector = starts[1];
+                line->host = starts[2];
+                line->port = starts[3];
+                return i + 2;
+            }
+            if (ends[fields - 1] == NULL) ends[fields - 1] = i;
+            if (*i == '\t' && fields < 4) {
+                starts[fields] = i + 1;
+                ends[fields] = NULL;
+                fields++;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Mark the tab, '\r' and '\n' characters of a block, one byte at a time.
+ * 
+ * @param ptr pointer to the start of the block
+ * @param length length of the block, at most DELIMITER_BLOCK
+ * @return mask with bit i set if ptr[i] is a delimiter
+ */
+static uint32_t delimiter_mask_scalar(const char *ptr, size_t length) {
+    uint32_t mask = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (ptr[i] == '\t' || ptr[i] == '\r' || ptr[i] == '\n')
+            mask |= (uint32_t)1 << i;
+    }
+
+    return mask;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/**
+ * Mark the tab, '\r' and '\n' characters of a block, 16 bytes at a time
+ * using SSE2. A block shorter than DELIMITER_BLOCK, at the end of the bytes
+ * received, is marked by the scalar version.
+ * 
+ * @param ptr pointer to the start of the block
+ * @param length length of the block, at most DELIMITER_BLOCK
+ * @return mask with bit i set if ptr[i] is a delimiter
+ */
+__attribute__((target("sse2")))
+static uint32_t delimiter_mask_sse2(const char *ptr, size_t length) {
+    if (length < DELIMITER_BLOCK) return delimiter_mask_scalar(ptr, length);
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+
+    __m128i low = _mm_loadu_si128((const __m128i *)ptr);
+    __m128i high = _mm_loadu_si128((const __m128i *)(ptr + 16));
+    __m128i low_match = _mm_or_si128(_mm_cmpeq_epi8(low, tab),
+            _mm_or_si128(_mm_cmpeq_epi8(low, cr), _mm_cmpeq_epi8(low, lf)));
+    __m128i high_match = _mm_or_si128(_mm_cmpeq_epi8(high, tab),
+            _mm_or_si128(_mm_cmpeq_epi8(high, cr), _mm_cmpeq_epi8(high, lf)));
+    return (uint32_t)_mm_movemask_epi8(low_match)
+           | (uint32_t)_mm_movemask_epi8(high_match) << 16;
+}
+
+/**
+ * Mark the tab, '\r' and '\n' characters of a block, 32 bytes at once using
+ * AVX2. A block shorter than DELIMITER_BLOCK, at the end of the bytes
+ * received, is marked by the scalar version. It is no faster than the SSE2
+ * version on the lines of a menu, so it is only selected by the benchmark.
+ * 
+ * @param ptr pointer to the start of the block
+ * @param length length of the block, at most DELIMITER_BLOCK
+ * @return mask with bit i set if ptr[i] is a delimiter
+ */
+__attribute__((target("avx2"), unused))
+static uint32_t delimiter_mask_avx2(const char *ptr, size_t length) {
+    if (length < DELIMITER_BLOCK) return delimiter_mask_scalar(ptr, length);
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+
+    __m256i chunk = _mm256_loadu_si256((const __m256i *)ptr);
+    __m256i match = _mm256_or_si256(_mm256_cmpeq_epi8(chunk, tab),
+            _mm256_or_si256(_mm256_cmpeq_epi8(chunk, cr),
+                            _mm256_cmpeq_epi8(chunk, lf)));
+    return (uint32_t)_mm256_movemask_epi8(match);
+}
+#endif
+
+/**
+ * Choose the implementation of delimiter_mask() according to the instruction
+ * sets supported by the CPU at runtime, falling back to the scalar version.
+ * SSE2 is preferred to AVX2, which the benchmark measures no faster.
+ */
+static void select_tokenizer(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) delimiter_mask = delimiter_mask_sse2;
+#endif
+}
+
+/**
+ * Given a line of a directory index split into its fields, index the item by
+ * adding it to the entry store.
+ * 
+ * @param line pointer to the fields of the directory index entry
+ * @param request pointer to the string of the request
+ * @return position of the item listed, ROOT if the line lists no item
+ */
+static size_t index_line(menu_line *line, char *request) {
+    char *record;
+    int item_type = classify_line(line, request, &record);
+    if (item_type == NOT_INDEXED) return ROOT;
+    return index_item(item_type, record);
+}
+
+/**
+ * Tell the item listed by a line of a directory index, without indexing it.
+ * 
+ * @param line pointer to the fields of the directory index entry
+ * @param request pointer to the string of the request
+ * @param record set to the record of the item listed
+ * @return type of the item listed, NOT_INDEXED if the line lists no item
+ */
+static int classify_line(menu_line *line, char *request, char **record) {
+    // Look up the type of that line from its first character, which also
+    // tells whether the entries of that class are indexed at all
+    int item_class = item_classes[(unsigned char)line->type];
+    int item_type = context->class_types[item_class];
+    // Add the invalid reference to the entry store
+    if (item_type == ERROR) {
+        *record = request;
+        return item_type;
+    }
+    // Disregard informational messages, end of response and irrelevant entries
+    if (item_type == NOT_INDEXED) return NOT_INDEXED;
+
+    // Add the directory/file to the entry store
+    char *pathname = line->selector;
+    // Disregard malformed lines without a pathname
+    if (pathname == NULL) return NOT_INDEXED;
+    // Index the directory/file
+    if (pathname[0] == '/') {
+        *record = pathname;
+        return item_type;
+    }
+    // A hypertext entry whose selector starts with "URL:" links to a URL
+    if (item_class == CLASS_HYPERTEXT && options->include_links
+            && strncmp(pathname, "URL:", 4) == 0) {
+        *record = pathname + 4;
+        return LINK;
+    }
+    if (item_type == DIRECTORY && pathname[0] == '\0' && line->host != NULL) {
+        // The hostname and the port are adjacent in the buffer: restore the
+        // tab in between to record them as "<hostname>\t<port>"
+        if (line->port != NULL) *(line->port - 1) = '\t';
+        *record = line->host;
+        return EXTERNAL;
+    }
+
+    return NOT_INDEXED;
+}
+
+/**
+ * Append an item to the entry store, growing every array of the store (and
+ * the index of its type) as needed.
+ * 
+ * Records are interned in the arena, so an identical pathname indexed as
+ * several types (e.g. a text file later found too large) is stored once, and
+ * the string never moves when the store grows.
+ * 
+ * @param item_type type of the record
+ * @param record pointer to the record string
+ * @param size size of a file if already known, otherwise SIZE_PENDING
+ * @return position of the new item, ROOT if out of memory (other than for
+ *         the root directory itself), which fails the crawl
+ */
+static size_t store_item(int item_type, char *record, ssize_t size) {
+    entry_store *store = &current->store;
+    if (store->count == store->capacity) {
+        // Each array grown is kept, so a failure leaves the store usable
+        size_t capacity = store->capacity == 0 ? 1024 : store->capacity * 2;
+        unsigned char *types = realloc(store->types, capacity);
+        if (types != NULL) store->types = types;
+        char **records = realloc(store->records, capacity * sizeof(char *));
+        if (records != NULL) store->records = records;
+        ssize_t *sizes = realloc(store->sizes, capacity * sizeof(ssize_t));
+        if (sizes != NULL) store->sizes = sizes;
+        uint64_t *hashes = realloc(store->hashes,
+                                   capacity * sizeof(uint64_t));
+        if (hashes != NULL) store->hashes = hashes;
+        int64_t *checked = realloc(store->checked,
+                                   capacity * sizeof(int64_t));
+        if (checked != NULL) store->checked = checked;
+        uint32_t *depths = realloc(store->depths,
+                                   capacity * sizeof(uint32_t));
+        if (depths != NULL) store->depths = depths;
+        if (types == NULL || records == NULL || sizes == NULL
+                || hashes == NULL || checked == NULL || depths == NULL) {
+            memory_failed();
+            return ROOT;
+        }
+        store->capacity = capacity;
+    }
+    char *interned = intern_string(record);
+    if (interned == NULL) return ROOT;
+    type_index *index = &store->by_type[item_type];
+    if (store->count > ROOT && index->count == index->capacity) {
+        size_t capacity = index->capacity == 0 ? 64 : index->capacity * 2;
+        size_t *items = realloc(index->items, capacity * sizeof(size_t));
+        if (items == NULL) {
+            memory_failed();
+            return ROOT;
+        }
+        index->items = items;
+        index->capacity = capacity;
+    }
+
+    size_t item = store->count++;
+    store->types[item] = item_type;
+    store->records[item] = interned;
+    store->sizes[item] = size;
+    store->hashes[item] = 0;
+    store->checked[item] = 0;
+    store->depths[item] = item == ROOT ? 0
+                          : store->depths[current->parent] + 1;
+    if (item == ROOT) return item;
+
+    index->items[index->count++] = item;
+    return item;
+}
+
+/**
+ * Allocate memory from the arena, starting a new block when the current one
+ * is full. The memory is only released all at once by cleanup(). Running out
+ * of memory fails the crawl of the current server.
+ * 
+ * @param size number of bytes to allocate
+ * @return pointer to memory aligned for any type, NULL on failure
+ */
+static void *arena_alloc(size_t size) {
+    size_t align = _Alignof(max_align_t);
+    size = (size + align - 1) & ~(align - 1);
+
+    arena_block *arena = current->arena;
+    if (arena == NULL || arena->capacity - arena->used < size) {
+        size_t capacity = size > ARENA_BLOCK ? size : ARENA_BLOCK;
+        arena_block *block = malloc(sizeof(arena_block) + capacity);
+        if (block == NULL) {
+            memory_failed();
+            return NULL;
+        }
+        block->next = arena;
+        block->used = 0;
+        block->capacity = capacity;
+        current->arena = arena = block;
+    }
+
+    void *ptr = arena->data + arena->used;
+    arena->used += size;
+    return ptr;
+}
+
+/**
+ * Return the copy of a string held by the string pool, adding a copy to the
+ * arena if the string has not been seen before.
+ * 
+ * @param str pointer to the string
+ * @return pointer to the interned copy of the string, NULL if out of memory,
+ *         which fails the crawl
+ */
+static char *intern_string(char *str) {
+    string_pool *strings = &current->strings;
+    // Double the table once it is half full
+    if ((strings->count + 1) * 2 > strings->capacity) {
+        size_t capacity = strings->capacity == 0 ? 1024 : strings->capacity * 2;
+        char **slots = calloc(capacity, sizeof(char *));
+        if (slots == NULL) {
+            memory_failed();
+            return NULL;
+        }
+        for (size_t j = 0; j < strings->capacity; j++) {
+            char *c = strings->slots[j];
+            if (c == NULL) continue;
+            size_t i = hash_string(FNV_OFFSET, c) & (capacity - 1);
+            while (slots[i] != NULL) i = (i + 1) & (capacity - 1);
+            slots[i] = c;
+        }
+        free(strings->slots);
+        strings->slots = slots;
+        strings->capacity = capacity;
+    }
+
+    size_t mask = strings->capacity - 1;
+    size_t i = hash_string(FNV_OFFSET, str) & mask;
+    for (; strings->slots[i] != NULL; i = (i + 1) & mask) {
+        if (strcmp(strings->slots[i], str) == 0) return strings->slots[i];
+    }
+
+    size_t len = strlen(str);
+    char *copy = arena_alloc(len + 1);
+    if (copy == NULL) return NULL;
+    memcpy(copy, str, len + 1);
+    strings->slots[i] = copy;
+    strings->count++;
+    return copy;
+}
+
+/**
+ * Make the following close() of a socket reset the connection (RST) instead
+ * of performing the orderly shutdown, discarding any data still in transit.
+ * 
+ * @param sock socket file descriptor
+ */
+static void abort_connection(int sock) {
+    struct linger linger;
+    linger.l_onoff = 1;
+    linger.l_linger = 0;
+    setsockopt(sock, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+}
+
+/**
+ * Upon sending a request to the Gopher server for the smallest text file,
+ * print the entire content to the terminal.
+ * 
+ * @param sock socket connected to the Gopher server
+ * @param request request line sent to the server
+ * @return 0 on success, -1 if the response failed
+ */
+static ssize_t print_response(int sock, char *request) {
+    // Buffer for strings read from the server
+    char buffer[BUFFER_SIZE + 1];
+    long long since = monotonic_ms();
+    long long first_byte = 0;
+    int stage = DEADLINE_FIRST_BYTE;
+
+    // Read the file from the server, each packet before its deadline
+    for (;;) {
+        long long deadline = request_deadline(PHASE_SIZE, stage, since,
+                                              first_byte);
+        if (!wait_socket(sock, POLLIN, deadline)) {
+            log_message(LOG_ERROR, stderr, "Error: Server response timeout\n");
+            index_item(TIMEOUT, request);
+            return -1;
+        }
+        ssize_t bytes_received = recv(sock, buffer, BUFFER_SIZE, 0);
+
+        // Handle failure in receiving server's response
+        if (bytes_received == -1) {
+            if (errno == EWOULDBLOCK || errno == EAGAIN || errno == EINTR)
+                continue;
+            log_message(LOG_ERROR, stderr,
+                        "Error: Unable to receive server response\n");
+            return -1;
+        }
+        if (bytes_received == 0) {
+            if (stage == DEADLINE_FIRST_BYTE)
+                fprintf(current->report, "Empty response from the server\n");
+            return 0;
+        }
+
+        since = monotonic_ms();
+        if (stage == DEADLINE_FIRST_BYTE) {
+            first_byte = since;
+            stage = DEADLINE_IDLE;
+            fprintf(current->report, "Content of the smallest text file:\n");
+        }
+        buffer[bytes_received] = '\0';
+        print_content(buffer);
+    }
+}
+
+/**
+ * Print the content of a text file, leaving out the ".\r\n" line which
+ * terminates the transmission.
+ * 
+ * @param content null-terminated content of the file
+ */
+static void print_content(char *content) {
+    char *eof = strstr(content, ".\r\n\0");
+    if (eof != NULL) *eof = '\0';
+    fprintf(current->report, "%s", content);
+}
+
+/**
+ * Free the heap memory occupied by the entry store once the crawl of the
+ * server completes. The records live in the arena, which is released one
+ * block at a time rather than one record at a time.
+ */
+static void cleanup(void) {
+    entry_store *store = &current->store;
+    while (current->arena != NULL) {
+        arena_block *next = current->arena->next;
+        free(current->arena);
+        current->arena = next;
+    }
+    free(store->types);
+    free(store->records);
+    free(store->sizes);
+    free(store->hashes);
+    free(store->checked);
+    free(store->depths);
+    for (int i = 0; i < NUM_OF_TYPES; i++) free(store->by_type[i].items);
+    memset(&current->store, 0, sizeof(entry_store));
+    free(current->items.slots);
+    free(current->strings.slots);
+    free(current->samples.samples);
+    memset(&current->samples, 0, sizeof(sample_log));
+}
+
+/**
+ * Add a new item to the entry store, log it and queue a directory to be
+ * indexed or a file to be evaluated.
+ * 
+ * @param item_type type of the record, which is not indexed yet
+ * @param record pointer to the record string
+ * @param size size of a file if already known, otherwise SIZE_PENDING
+ * @return position of the new item, ROOT if out of memory
+ */
+static size_t add_item(int item_type, char *record, ssize_t size) {
+    size_t item = store_item(item_type, record, size);
+    if (item == ROOT || !insert_item(item)) return ROOT;
+    record = current->store.records[item];
+
+    // For logging the type of item indexed
+    char *type_name = "item";
+    if (item_type == DIRECTORY) type_name = "directory";
+    else if (item_type == TEXT) type_name = "text file";
+    else if (item_type == BINARY) type_name = "binary file";
+    else if (item_type == ERROR) type_name = "invalid request";
+    else if (item_type == EXTERNAL) type_name = "external server";
+    else if (item_type == TIMEOUT) type_name = "timeout";
+    else if (item_type == TOO_LARGE) type_name = "too large";
+    else if (item_type == SEARCH) type_name = "search server";
+    else if (item_type == LINK) type_name = "URL link";
+    else if (item_type == CONNECT_FAILED) type_name = "connection failed";
+
+    // Log the new item
+    if (item_type == ERROR)
+        // For optimising visualisation
+        log_message(LOG_INFO, stdout, "Indexed %s: %s", type_name, record);
+    else if (item_type == TIMEOUT)
+        log_message(LOG_ERROR, stderr, "Transmission %s: %s", type_name,
+                    record);
+    else if (item_type == TOO_LARGE)
+        log_message(LOG_ERROR, stderr, "File %s: %s\n", type_name, record);
+    else if (item_type == CONNECT_FAILED)
+        log_message(LOG_ERROR, stderr, "Connection failed: %s", record);
+    else
+        log_message(LOG_INFO, stdout, "Indexed %s: %s\n", type_name, record);
+
+    log_checkpoint(CHECKPOINT_ITEM, item, current->store.depths[item]);
+    if (size != SIZE_PENDING) log_checkpoint(CHECKPOINT_SIZE, item, size);
+    if (size != SIZE_PENDING) tally_size(item);
+
+    // Entries not requested are output at once, the others once requested
+    if (item_type == ERROR) output_item(item, OUTPUT_INVALID, -1, -1);
+    else if (item_type == SEARCH || item_type == LINK)
+        output_item(item, OUTPUT_INDEXED, -1, -1);
+    else if ((item_type == TEXT || item_type == BINARY)
+            && size != SIZE_PENDING)
+        output_item(item, size == SIZE_TOO_LARGE ? OUTPUT_TOO_LARGE
+                    : OUTPUT_REUSED, size < 0 ? -1 : size, -1);
+
+    // List the item as soon as it is indexed when the report is streamed
+    FILE *listing = current->listings[item_type];
+    if (listing != NULL && (item_type == ERROR || item_type == TIMEOUT
+                            || item_type == TOO_LARGE
+                            || item_type == CONNECT_FAILED))
+        print_issue(listing, item);
+    else if (listing != NULL)
+        fprintf(listing, "%s\n", record);
+
+    // Subdirectories are indexed and the sizes of files evaluated once a
+    // connection slot becomes available, unless known from a previous crawl
+    if (item_type == DIRECTORY) frontier_push(&current->queue, item);
+    else if ((item_type == TEXT || item_type == BINARY)
+            && size == SIZE_PENDING)
+        frontier_push(&current->files, item);
+
+    return item;
+}
+
+/**
+ * Index a record unless an item of the same type and record already exists.
+ * Duplicates are detected before storing anything.
+ * 
+ * @param item_type type of the record
+ * @param record pointer to the record string
+ * @return position of the item, whether new or already indexed, ROOT if out
+ *         of memory
+ */
+static size_t index_item(int item_type, char *record) {
+    size_t item = find_item(item_type, record);
+    if (item != ROOT) return item;
+    return add_item(item_type, record, SIZE_PENDING);
+}
+
+/**
+ * Look up an indexed item in the hash set.
+ * 
+ * @param item_type type of the record
+ * @param record pointer to the record string
+ * @return position of the indexed item, ROOT if it does not exist
+ */
+static size_t find_item(int item_type, char *record) {
+    if (current->items.count == 0) return ROOT;
+
+    size_t mask = current->items.capacity - 1;
+    size_t i = hash_item(item_type, record) & mask;
+    for (; current->items.slots[i] != ROOT; i = (i + 1) & mask) {
+        size_t item = current->items.slots[i];
+        if (current->store.types[item] == item_type
+                && strcmp(current->store.records[item], record) == 0)
+            return item;
+    }
+
+    return ROOT;
+}
+
+/**
+ * Insert an item known not to exist into the hash set. The table is doubled
+ * once it is half full to keep the probe sequences short.
+ * 
+ * @param item position of the new indexed item
+ * @return false if out of memory, which fails the crawl
+ */
+static bool insert_item(size_t item) {
+    entry_store *store = &current->store;
+    item_set *items = &current->items;
+    if ((items->count + 1) * 2 > items->capacity) {
+        size_t capacity = items->capacity == 0 ? 1024 : items->capacity * 2;
+        size_t *slots = calloc(capacity, sizeof(size_t));
+        if (slots == NULL) {
+            memory_failed();
+            return false;
+        }
+        for (size_t j = 0; j < items->capacity; j++) {
+            size_t c = items->slots[j];
+            if (c == ROOT) continue;
+            size_t i = hash_item(store->types[c], store->records[c])
+                       & (capacity - 1);
+            while (slots[i] != ROOT) i = (i + 1) & (capacity - 1);
+            slots[i] = c;
+        }
+        free(items->slots);
+        items->slots = slots;
+        items->capacity = capacity;
+    }
+
+    size_t mask = items->capacity - 1;
+    size_t i = hash_item(store->types[item], store->records[item]) & mask;
+    while (items->slots[i] != ROOT) i = (i + 1) & mask;
+    items->slots[i] = item;
+    items->count++;
+
+    return true;
+}
+
+/**
+ * Hash the key of an indexed item using 64-bit FNV-1a, with the type mixed in
+ * as the first byte.
+ * 
+ * @param item_type type of the record
+ * @param record pointer to the record string
+ * @return hash value of the item
+ */
+static uint64_t hash_item(int item_type, char *record) {
+    uint64_t hash = FNV_OFFSET;
+    hash = (hash ^ (unsigned char)item_type) * 0x100000001b3ULL;
+    return hash_string(hash, record);
+}
+
+/**
+ * Continue a 64-bit FNV-1a hash over the bytes of a string.
+ * 
+ * @param hash hash value of the preceding bytes (or the offset basis)
+ * @param str pointer to the string
+ * @return hash value including the string
+ */
+static uint64_t hash_string(uint64_t hash, char *str) {
+    for (unsigned char *c = (unsigned char *)str; *c != '\0'; c++)
+        hash = (hash ^ *c) * 0x100000001b3ULL;
+    return hash;
+}
+
+/**
+ * Continue a 64-bit FNV-1a hash over a sequence of bytes.
+ * 
+ * @param hash hash value of the preceding bytes (or the offset basis)
+ * @param data pointer to the bytes
+ * @param length number of bytes
+ * @return hash value including the bytes
+ */
+static uint64_t hash_bytes(uint64_t hash, char *data, size_t length) {
+    unsigned char *c = (unsigned char *)data;
+    for (size_t i = 0; i < length; i++)
+        hash = (hash ^ c[i]) * 0x100000001b3ULL;
+    return hash;
+}
+
+/**
+ * Start the XXH64 hash of the content of a file, with a seed of 0.
+ * 
+ * @param h state of the hash
+ */
+static void content_start(content_hash *h) {
+    h->lanes[0] = PRIME64_1 + PRIME64_2;
+    h->lanes[1] = PRIME64_2;
+    h->lanes[2] = 0;
+    h->lanes[3] = -PRIME64_1;
+    h->tail_length = 0;
+    h->length = 0;
+}
+
+/**
+ * Continue the XXH64 hash of a file over the bytes just received. Bytes
+ * short of a whole stripe are kept in the tail until the next bytes arrive,
+ * so the hash does not depend on how the content was split into packets.
+ * 
+ * @param h state of the hash
+ * @param data pointer to the bytes
+ * @param length number of bytes
+ */
+static void content_update(content_hash *h, char *data, size_t length) {
+    unsigned char *p = (unsigned char *)data;
+    unsigned char *end = p + length;
+    h->length += length;
+
+    // Complete the stripe started by the previous bytes
+    if (h->tail_length > 0) {
+        size_t missing = HASH_STRIPE - h->tail_length;
+        if (length < missing) {
+            memcpy(h->tail + h->tail_length, p, length);
+            h->tail_length += length;
+            return;
+        }
+        memcpy(h->tail + h->tail_length, p, missing);
+        for (int i = 0; i < 4; i++)
+            h->lanes[i] = content_round(h->lanes[i],
+                                        content_read64(h->tail + 8 * i));
+        p += missing;
+        h->tail_length = 0;
+    }
+
+    // The four lanes are independent of each other within a stripe
+    uint64_t v1 = h->lanes[0], v2 = h->lanes[1];
+    uint64_t v3 = h->lanes[2], v4 = h->lanes[3];
+    for (; end - p >= HASH_STRIPE; p += HASH_STRIPE) {
+        v1 = content_round(v1, content_read64(p));
+        v2 = content_round(v2, content_read64(p + 8));
+        v3 = content_round(v3, content_read64(p + 16));
+        v4 = content_round(v4, content_read64(p + 24));
+    }
+    h->lanes[0] = v1;
+    h->lanes[1] = v2;
+    h->lanes[2] = v3;
+    h->lanes[3] = v4;
+
+    memcpy(h->tail, p, end - p);
+    h->tail_length = end - p;
+}
+
+/**
+ * Finish the XXH64 hash of the content of a file.
+ * 
+ * @param h state of the hash after all the bytes of the file
+ * @return hash value of the content, never 0 (which stands for no hash)
+ */
+static uint64_t content_digest(content_hash *h) {
+    uint64_t hash = PRIME64_5;
+    if (h->length >= HASH_STRIPE) {
+        uint64_t *v = h->lanes;
+        hash = (v[0] << 1 | v[0] >> 63) + (v[1] << 7 | v[1] >> 57)
+               + (v[2] << 12 | v[2] >> 52) + (v[3] << 18 | v[3] >> 46);
+        for (int i = 0; i < 4; i++) {
+            hash ^= content_round(0, v[i]);
+            hash = hash * PRIME64_1 + PRIME64_4;
+        }
+    }
+    hash += h->length;
+
+    // Mix in the bytes of the tail, 8, 4 and then 1 at a time
+    unsigned char *p = h->tail;
+    unsigned char *end = p + h->tail_length;
+    for (; end - p >= 8; p += 8) {
+        hash ^= content_round(0, content_read64(p));
+        hash = (hash << 27 | hash >> 37) * PRIME64_1 + PRIME64_4;
+    }
+    if (end - p >= 4) {
+        uint32_t word;
+        memcpy(&word, p, sizeof(word));
+        hash ^= word * PRIME64_1;
+        hash = (hash << 23 | hash >> 41) * PRIME64_2 + PRIME64_3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        hash ^= *p * PRIME64_5;
+        hash = (hash << 11 | hash >> 53) * PRIME64_1;
+    }
+
+    // Avalanche the bits of the hash
+    hash ^= hash >> 33;
+    hash *= PRIME64_2;
+    hash ^= hash >> 29;
+    hash *= PRIME64_3;
+    hash ^= hash >> 32;
+    return hash != 0 ? hash : 1;
+}
+
+/**
+ * Mix 8 bytes of content into a lane of the XXH64 hash.
+ * 
+ * @param lane accumulator of the lane
+ * @param input next 8 bytes of the lane
+ * @return accumulator including the bytes
+ */
+static uint64_t content_round(uint64_t lane, uint64_t input) {
+    lane += input * PRIME64_2;
+    lane = lane << 31 | lane >> 33;
+    return lane * PRIME64_1;
+}
+
+/**
+ * Read 8 bytes of content as an integer in host byte order, whatever their
+ * alignment.
+ * 
+ * @param p pointer to the bytes
+ * @return integer value of the bytes
+ */
+static uint64_t content_read64(unsigned char *p) {
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+/**
+ * Evaluate and print to the terminal:
+ *     1. Number of directories, text files, binaries and invalid references
+ *     2. Sizes of the smallest/largest text/binary files
+ *     3. Content of the smallest text file
+ */
+static void evaluate(void) {
+    entry_store *store = &current->store;
+    file_cache *smallest = &current->smallest;
+    FILE *report = current->report;
+    fprintf(report, "\nIndexation complete. Now analysing the files.\n");
+    int num_of_directories = store->by_type[DIRECTORY].count;
+    int num_of_text_files = store->by_type[TEXT].count;
+    int num_of_binary_files = store->by_type[BINARY].count;
+    int num_of_invalid_references = store->by_type[ERROR].count;
+
+    /* The smallest and largest files are kept up to date by tally_size() as
+       the sizes are evaluated by crawl(), and the number of items of each
+       type by the entry store as they are indexed. Nothing is scanned. */
+    size_summary *summary = &current->summary;
+    char *smallest_text_file = summary->smallest_text == ROOT ? NULL
+                               : store->records[summary->smallest_text];
+    int size_of_smallest_text_file = summary->smallest_text == ROOT ? -1
+                                     : store->sizes[summary->smallest_text];
+    int size_of_largest_text_file = summary->largest_text == ROOT ? -1
+                                    : store->sizes[summary->largest_text];
+    int size_of_smallest_binary_file = summary->smallest_binary == ROOT ? -1
+                                       : store->sizes[summary->smallest_binary];
+    int size_of_largest_binary_file = summary->largest_binary == ROOT ? -1
+                                      : store->sizes[summary->largest_binary];
+
+    // Print the number of directories, text files, binary files and errors
+    fprintf(report, "\nNumber of directories: %d\n"
+                    "Number of text files: %d\n"
+                    "Number of binary files: %d\n"
+                    "Number of invalid references: %d\n",
+                    num_of_directories, num_of_text_files,
+                    num_of_binary_files, num_of_invalid_references);
+    if (context->class_types[CLASS_SEARCH] == SEARCH)
+        fprintf(report, "Number of search servers: %zu\n",
+                store->by_type[SEARCH].count);
+    if (options->include_links)
+        fprintf(report, "Number of URL links: %zu\n",
+                store->by_type[LINK].count);
+    fprintf(report, "\n");
+
+    // Print the content of the smallest text file, from the cache if possible
+    if (smallest->item != ROOT
+            && store->records[smallest->item] == smallest_text_file) {
+        fprintf(report, "Content of the smallest text file:\n");
+        smallest->data[smallest->length] = '\0';
+        print_content(smallest->data);
+    }
+    else if (smallest_text_file != NULL)
+        gopher_connect(print_response, smallest_text_file);
+    free(smallest->data);
+    smallest->data = NULL;
+    smallest->item = ROOT;
+
+    // Print the sizes of the smallest/largest text/binary files
+    fprintf(report, "\nSize of the smallest text file: %d\n"
+                    "Size of the largest text file: %d\n"
+                    "Size of the smallest binary file: %d\n"
+                    "Size of the largest binary file: %d\n",
+                    size_of_smallest_text_file, size_of_largest_text_file,
+                    size_of_smallest_binary_file, size_of_largest_binary_file);
+    bool limited = options->max_depth >= 0 || options->max_requests > 0
+                   || options->time_budget > 0;
+    if (options->size_budget > 0 || limited)
+        fprintf(report, "Number of files not measured within the %s: %zu\n",
+                limited ? "limits" : "size budget", current->skipped);
+    if (limited)
+        fprintf(report, "Number of directories not crawled within the "
+                        "limits: %zu\n", current->unvisited);
+
+    fprintf(report, "\nList of text files (full path):\n");
+    list_full_path(TEXT);
+
+    fprintf(report, "\nList of binary files (full path):\n");
+    list_full_path(BINARY);
+
+    if (options->hash_files) {
+        fprintf(report, "\nFiles with identical content (full path):\n");
+        list_duplicates();
+    }
+
+    if (context->class_types[CLASS_SEARCH] == SEARCH) {
+        fprintf(report, "\nList of search servers (full path):\n");
+        list_full_path(SEARCH);
+    }
+    if (options->include_links) {
+        fprintf(report, "\nList of URL links:\n");
+        list_full_path(LINK);
+    }
+
+    // Test and print the connectivity to external servers
+    fprintf(report, "\nConnectivity to external servers:\n");
+    test_external_servers();
+    
+    // List all references with issues/errors in the order indexed, scanning
+    // the types of all items rather than merging four type indices
+    fprintf(report, "\nReferences with issues/errors:\n");
+    size_t num_of_issues = store->by_type[ERROR].count
+                           + store->by_type[TIMEOUT].count
+                           + store->by_type[TOO_LARGE].count
+                           + store->by_type[CONNECT_FAILED].count;
+    if (num_of_issues == 0)
+        fprintf(report, "No reference with issue/error found\n");
+    else if (current->listings[ERROR] != NULL)
+        fprintf(report, "%zu listed in %s/%s\n", num_of_issues,
+                current->listing_path, ISSUES_LISTING);
+    else {
+        for (size_t item = ROOT + 1; item < store->count; item++) {
+            int type = store->types[item];
+            if (type == ERROR || type == TIMEOUT || type == TOO_LARGE
+                    || type == CONNECT_FAILED)
+                print_issue(report, item);
+        }
+    }
+    // Summarise the latency and throughput of every phase
+    print_metrics(report, current->metrics);
+    rate_limiter *limiter = &current->limiter;
+    fprintf(report, "Requests in flight: up to %d of %d, halved %d time%s "
+                    "after timeouts\n", limiter->peak, options->concurrency,
+            limiter->reductions, limiter->reductions == 1 ? "" : "s");
+}
+
+/**
+ * Print the full pathnames of all items of a specify type, or where they are
+ * listed if the report is streamed.
+ * 
+ * @param item_type type of item
+ */
+static void list_full_path(int item_type) {
+    type_index *index = &current->store.by_type[item_type];
+    if (current->listings[item_type] != NULL) {
+        fprintf(current->report, "%zu listed in %s/%s\n", index->count,
+                current->listing_path, listing_names[item_type]);
+        return;
+    }
+    for (size_t i = 0; i < index->count; i++)
+        fprintf(current->report, "%s\n",
+                current->store.records[index->items[i]]);
+}
+
+/**
+ * Print a reference with an issue, i.e. an invalid reference, a timeout, a
+ * file too large or a connection which failed.
+ * 
+ * @param out stream of the report or the listing
+ * @param item position of the reference
+ */
+static void print_issue(FILE *out, size_t item) {
+    int type = current->store.types[item];
+    char *issue_type = "Invalid reference";
+    if (type == TIMEOUT) issue_type = "Timeout";
+    else if (type == TOO_LARGE) issue_type = "File too large";
+    else if (type == CONNECT_FAILED) issue_type = "Connection failed";
+    fprintf(out, "(%s) %s", issue_type, current->store.records[item]);
+    if (type != TOO_LARGE) return;
+
+    // A file stopped at the file limit in this crawl has a lower bound
+    file_sample *sample = find_sample(item);
+    if (sample != NULL && sample->duration > 0)
+        fprintf(out, ": at least %lld bytes, received at %.3f MB/s",
+                (long long)sample->bytes,
+                (double)sample->bytes / sample->duration);
+    else if (sample != NULL)
+        fprintf(out, ": at least %lld bytes", (long long)sample->bytes);
+    fprintf(out, "\n");
+}
+
+/**
+ * Print the full pathnames of the text/binary files whose content is
+ * identical to that of another file, i.e. of the same size and content hash,
+ * grouped by content. Empty files are not considered.
+ */
+static void list_duplicates(void) {
+    entry_store *store = &current->store;
+    size_t count = store->by_type[TEXT].count + store->by_type[BINARY].count;
+    size_t *files = malloc((count + 1) * sizeof(size_t));
+    if (files == NULL) {
+        memory_failed();
+        return;
+    }
+    size_t num_of_files = 0;
+    for (int type = TEXT; type <= BINARY; type++) {
+        type_index *index = &store->by_type[type];
+        for (size_t i = 0; i < index->count; i++) {
+            size_t item = index->items[i];
+            if (store->sizes[item] > 0 && store->hashes[item] != 0)
+                files[num_of_files++] = item;
+        }
+    }
+    qsort(files, num_of_files, sizeof(size_t), compare_contents);
+
+    // Files of the same content are adjacent, in the order indexed
+    size_t num_of_groups = 0;
+    for (size_t i = 0; i < num_of_files;) {
+        size_t j = i + 1;
+        while (j < num_of_files
+                && store->hashes[files[j]] == store->hashes[files[i]]
+                && store->sizes[files[j]] == store->sizes[files[i]])
+            j++;
+        if (j - i > 1) {
+            fprintf(current->report, "%zu files of %zd bytes:\n", j - i,
+                    store->sizes[files[i]]);
+            for (size_t k = i; k < j; k++)
+                fprintf(current->report, "    %s\n",
+                        store->records[files[k]]);
+            num_of_groups++;
+        }
+        i = j;
+    }
+    if (num_of_groups == 0)
+        fprintf(current->report, "No files with identical content found\n");
+    free(files);
+}
+
+/**
+ * Order files by content hash, then by size and then in the order indexed.
+ * 
+ * @param a pointer to the position of the first file
+ * @param b pointer to the position of the second file
+ * @return negative, zero or positive as for strcmp()
+ */
+static int compare_contents(const void *a, const void *b) {
+    entry_store *store = &current->store;
+    size_t x = *(const size_t *)a;
+    size_t y = *(const size_t *)b;
+    if (store->hashes[x] != store->hashes[y])
+        return store->hashes[x] < store->hashes[y] ? -1 : 1;
+    if (store->sizes[x] != store->sizes[y])
+        return store->sizes[x] < store->sizes[y] ? -1 : 1;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Update the smallest and largest files with a file whose size is known.
+ * Files too large or failing to arrive are not considered. Of files of the
+ * same size, the one indexed first is the smallest.
+ * 
+ * @param item position of the text/binary file
+ */
+static void tally_size(size_t item) {
+    entry_store *store = &current->store;
+    size_summary *summary = &current->summary;
+    ssize_t size = store->sizes[item];
+    if (size < 0) return;
+
+    bool text = store->types[item] == TEXT;
+    size_t *smallest = text ? &summary->smallest_text
+                            : &summary->smallest_binary;
+    size_t *largest = text ? &summary->largest_text : &summary->largest_binary;
+    if (*smallest == ROOT || size < store->sizes[*smallest]
+            || (size == store->sizes[*smallest] && item < *smallest))
+        *smallest = item;
+    if (*largest == ROOT || size > store->sizes[*largest]) *largest = item;
+}
+
+/**
+ * Create the directory of the listings of the report and open a listing for
+ * every type listed, so that items are written out as they are indexed. The
+ * references with issues share one listing.
+ * 
+ * @return whether all the listings were opened
+ */
+static bool open_listings(void) {
+    char *dir = current->listing_path;
+    if (mkdir(dir, 0755) == -1 && errno != EEXIST) {
+        log_message(LOG_FATAL, stderr, "Error: Unable to create %s\n", dir);
+        return false;
+    }
+
+    for (int type = 0; type < NUM_OF_TYPES; type++) {
+        if (listing_names[type] == NULL || (type == SEARCH
+                && context->class_types[CLASS_SEARCH] != SEARCH)
+                || (type == LINK && !options->include_links))
+            continue;
+        if (type == TIMEOUT || type == TOO_LARGE || type == CONNECT_FAILED) {
+            current->listings[type] = current->listings[ERROR];
+            continue;
+        }
+        size_t length = strlen(dir) + strlen(listing_names[type]) + 2;
+        char path[length];
+        snprintf(path, length, "%s/%s", dir, listing_names[type]);
+        current->listings[type] = fopen(path, "w");
+        if (current->listings[type] == NULL) {
+            log_message(LOG_FATAL, stderr, "Error: Unable to write %s\n",
+                        path);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Close the listings of the report once it is complete.
+ */
+static void close_listings(void) {
+    for (int type = 0; type < NUM_OF_TYPES; type++) {
+        if (current->listings[type] == NULL) continue;
+        if (type != TIMEOUT && type != TOO_LARGE && type != CONNECT_FAILED)
+            fclose(current->listings[type]);
+        current->listings[type] = NULL;
+    }
+    free(current->listing_path);
+    current->listing_path = NULL;
+}
+
+/**
+ * Consider the external servers indexed and recorded in the entry store.
+ * Test whether those external servers are up and print the status.
+ * 
+ * All the servers are tested at once. Identical host:port pairs are tested
+ * only once, the hostnames are resolved in parallel by the resolver cache and
+ * the connections are attempted together on a single epoll set. Each stage
+ * has one deadline for all the servers rather than one per server.
+ */
+static void test_external_servers(void) {
+    // Extract the server's hostname and port from every entry
+    type_index *servers = &current->store.by_type[EXTERNAL];
+    size_t count = servers->count;
+    if (count == 0) {
+        fprintf(current->report,
+                "No reference to any external server indexed\n");
+        return;
+    }
+
+    external_probe *probes = calloc(count, sizeof(external_probe));
+    if (probes == NULL) {
+        memory_failed();
+        return;
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++) {
+        external_probe *probe = &probes[n];
+        probe->hostname = strdup(current->store.records[servers->items[i]]);
+        if (probe->hostname == NULL) {
+            memory_failed();
+            for (size_t j = 0; j < i; j++) free(probes[j].hostname);
+            free(probes);
+            return;
+        }
+        probe->port = strchr(probe->hostname, '\t');
+        if (probe->port != NULL) *probe->port++ = '\0';
+        else probe->port = "70";
+        probe->target = n++;
+    }
+
+    // Sort the probes by host:port so that duplicates become adjacent
+    external_probe **order = malloc(count * sizeof(external_probe *));
+    char **hostnames = malloc(count * sizeof(char *));
+    if (order == NULL || hostnames == NULL) {
+        memory_failed();
+        for (size_t i = 0; i < count; i++) free(probes[i].hostname);
+        free(probes);
+        free(order);
+        free(hostnames);
+        return;
+    }
+    for (size_t i = 0; i < count; i++) order[i] = &probes[i];
+    qsort(order, count, sizeof(external_probe *), compare_probes);
+    for (size_t i = 1; i < count; i++) {
+        if (compare_probes(&order[i - 1], &order[i]) == 0)
+            order[i]->target = order[i - 1]->target;
+    }
+    free(order);
+
+    // Resolve the hostnames of all distinct servers in parallel
+    size_t num_of_hostnames = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (probes[i].target == i)
+            hostnames[num_of_hostnames++] = probes[i].hostname;
+    }
+    resolve_hosts(hostnames, num_of_hostnames);
+    free(hostnames);
+
+    // Attempt all the connections at once, racing the addresses of each
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    for (size_t i = 0; i < count; i++) {
+        external_probe *probe = &probes[i];
+        if (probe->target != i) continue;
+        pthread_mutex_lock(&context->resolver_lock);
+        struct addrinfo *addr = cached_addresses(probe->hostname);
+        if (addr != NULL)
+            race_prepare(&probe->race, addr, atoi(probe->port));
+        pthread_mutex_unlock(&context->resolver_lock);
+        if (addr == NULL) continue;
+
+        // No need to test if the current server is referenced
+        for (int a = 0; a < probe->race.count && !probe->self; a++)
+            probe->self = same_address(&probe->race.addrs[a],
+                                       (struct sockaddr *)&current->addr);
+        if (probe->self) continue;
+
+        probe->timing.started = monotonic_us();
+        probe_attempt(probe, i, epoll_fd);
+    }
+
+    // Wait for the connections until the common deadline, attempting the
+    // next address of a server once the previous attempts have failed or
+    // RACE_DELAY has passed
+    long long deadline = request_deadline(PHASE_EXTERNAL, DEADLINE_CONNECT,
+                                          monotonic_ms(), 0);
+    struct epoll_event events[MAX_EVENTS];
+    for (;;) {
+        long long now = monotonic_ms();
+        long long next = deadline;
+        bool pending = false;
+        for (size_t i = 0; i < count; i++) {
+            external_probe *probe = &probes[i];
+            address_race *race = &probe->race;
+            if (probe->target != i || probe->up || race->started == 0
+                    || probe->timing.failed)
+                continue;
+            bool more = race->started < race->count;
+            if (more && (!race_pending(race) || now >= race->next)) {
+                probe_attempt(probe, i, epoll_fd);
+                if (probe->up) continue;
+                more = race->started < race->count;
+            }
+            if (!race_pending(race) && !more) {
+                probe->timing.failed = true;
+                record_request(PHASE_EXTERNAL, &probe->timing);
+                continue;
+            }
+            pending = true;
+            if (more && (next == NO_DEADLINE || race->next < next))
+                next = race->next;
+        }
+        if (!pending || (deadline != NO_DEADLINE && now >= deadline)) break;
+
+        int wait = next == NO_DEADLINE ? -1 : (int)(next - now);
+        if (next != NO_DEADLINE && wait < 0) wait = 0;
+        int ready = epoll_wait(epoll_fd, events, MAX_EVENTS, wait);
+        if (ready == -1 && errno != EINTR) break;
+        for (int i = 0; i < ready; i++) {
+            // The probe and its attempt are encoded in the event data
+            external_probe *probe = &probes[events[i].data.u64
+                                            / RACE_CANDIDATES];
+            int attempt = events[i].data.u64 % RACE_CANDIDATES;
+            if (probe->up || probe->race.fds[attempt] == -1) continue;
+            if (!race_check(&probe->race, attempt)) continue;
+            probe->up = true;
+            probe->timing.connected = monotonic_us();
+            record_request(PHASE_EXTERNAL, &probe->timing);
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, probe->race.fds[attempt], NULL);
+        }
+    }
+    close(epoll_fd);
+
+    // Print the status of every reference in the order indexed
+    for (size_t i = 0; i < count; i++) {
+        external_probe *target = &probes[probes[i].target];
+        long long latency = target->up ? target->timing.connected
+                                         - target->timing.started : -1;
+        output_entry(EXTERNAL, "", probes[i].hostname, atoi(probes[i].port),
+                     target->self ? OUTPUT_SELF
+                     : target->up ? OUTPUT_UP : OUTPUT_DOWN, -1, latency);
+        if (target->self) continue;
+        fprintf(current->report, "Server %s at port %s is %s\n",
+                probes[i].hostname, probes[i].port,
+                target->up ? "up" : "down");
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        external_probe *probe = &probes[i];
+        // Connections still pending at the deadline count as failures
+        if (probe->race.started > 0 && !probe->up && !probe->timing.failed) {
+            probe->timing.failed = true;
+            record_request(PHASE_EXTERNAL, &probe->timing);
+        }
+        for (int a = 0; a < probe->race.started; a++)
+            if (probe->race.fds[a] != -1) close(probe->race.fds[a]);
+        free(probe->hostname);
+    }
+    free(probes);
+}
+
+/**
+ * Start the next connection attempt of the race of an external server, and
+ * wait for it on the event loop unless established at once.
+ * 
+ * @param probe probe of the external server
+ * @param index position of the probe
+ * @param epoll_fd file descriptor of the event loop
+ */
+static void probe_attempt(external_probe *probe, size_t index,
+                          int epoll_fd) {
+    int sock = race_attempt(&probe->race, 0);
+    if (sock == -1) return;
+    if (probe->race.winner != -1) {
+        probe->up = true;
+        probe->timing.connected = monotonic_us();
+        record_request(PHASE_EXTERNAL, &probe->timing);
+        return;
+    }
+    struct epoll_event event;
+    event.events = EPOLLOUT;
+    event.data.u64 = index * RACE_CANDIDATES + probe->race.started - 1;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sock, &event);
+}
+
+/**
+ * Order external servers by hostname (case-insensitively) and then by port.
+ * 
+ * @param a pointer to a pointer to the first probe
+ * @param b pointer to a pointer to the second probe
+ * @return negative, zero or positive as for strcmp()
+ */
+static int compare_probes(const void *a, const void *b) {
+    const external_probe *x = *(external_probe *const *)a;
+    const external_probe *y = *(external_probe *const *)b;
+    int order = strcasecmp(x->hostname, y->hostname);
+    if (order != 0) return order;
+    return atoi(x->port) - atoi(y->port);
+}
+
+/**
+ * Look up the addresses of a hostname in the resolver cache. The caller holds
+ * resolver_lock for as long as it uses the addresses, which are freed once
+ * the hostname is resolved again.
+ * 
+ * @param hostname hostname or IP address
+ * @return list of addresses, NULL if the hostname has not been resolved
+ */
+static struct addrinfo *cached_addresses(char *hostname) {
+    dns_record *record = find_dns_record(hostname);
+    return record != NULL ? record->addresses : NULL;
+}
+
+/**
+ * Resolve a batch of hostnames in parallel with getaddrinfo_a(), skipping
+ * those with addresses still valid in the resolver cache.
+ * 
+ * An expired record which still holds addresses is refreshed in the
+ * background while the old addresses remain in use, so only hostnames never
+ * resolved successfully are waited for, up to DNS_TIMEOUT altogether. A
+ * lookup outliving the deadline carries on and is collected by a later call.
+ * 
+ * The lookups are started with resolver_lock held, which is released while
+ * they are waited for, so that other workers can use the cache meanwhile.
+ * Several workers may wait for the same lookup; whichever acquires the lock
+ * first once it has finished publishes its result.
+ * 
+ * @param hostnames array of hostnames or IP addresses
+ * @param count number of hostnames
+ */
+static void resolve_hosts(char **hostnames, size_t count) {
+    long long now = monotonic_ms();
+    struct gaicb **lookups = malloc(count * sizeof(struct gaicb *));
+    dns_record **started = malloc(count * sizeof(dns_record *));
+    if (lookups == NULL || started == NULL) {
+        memory_failed();
+        free(lookups);
+        free(started);
+        return;
+    }
+    int num_of_lookups = 0;
+
+    pthread_mutex_lock(&context->resolver_lock);
+    for (size_t i = 0; i < count; i++) {
+        dns_record *record = find_dns_record(hostnames[i]);
+        if (record == NULL) record = create_dns_record(hostnames[i]);
+        if (record == NULL) {
+            memory_failed();
+            continue;
+        }
+        if (record->pending || record->expires > now) continue;
+
+        record->hints.ai_family = AF_UNSPEC;
+        record->hints.ai_socktype = SOCK_STREAM;
+        record->lookup.ar_name = record->hostname;
+        record->lookup.ar_service = NULL;
+        record->lookup.ar_request = &record->hints;
+        record->lookup.ar_result = NULL;
+        record->pending = true;
+        started[num_of_lookups] = record;
+        lookups[num_of_lookups++] = &record->lookup;
+    }
+    if (num_of_lookups > 0
+            && getaddrinfo_a(GAI_NOWAIT, lookups, num_of_lookups, NULL) != 0) {
+        log_message(LOG_ERROR, stderr, "Error: Unable to resolve hostnames\n");
+        for (int i = 0; i < num_of_lookups; i++) {
+            started[i]->pending = false;
+            started[i]->expires = now + DNS_NEGATIVE_TTL;
+        }
+    }
+
+    // Note the lookups of the hostnames without usable addresses, which are
+    // waited for outside the lock. A record is never freed nor started again
+    // within DNS_TIMEOUT of its result, so its lookup stays valid meanwhile.
+    int num_of_waits = 0;
+    for (size_t i = 0; i < count; i++) {
+        dns_record *record = find_dns_record(hostnames[i]);
+        if (record != NULL && record->pending && record->addresses == NULL)
+            lookups[num_of_waits++] = &record->lookup;
+    }
+    pthread_mutex_unlock(&context->resolver_lock);
+
+    long long deadline = now + DNS_TIMEOUT;
+    for (int i = 0; i < num_of_waits; i++) {
+        while (gai_error(lookups[i]) == EAI_INPROGRESS) {
+            long long remaining = deadline - monotonic_ms();
+            if (remaining <= 0) break;
+            struct timespec timeout = {remaining / 1000,
+                                       remaining % 1000 * 1000000};
+            gai_suspend((const struct gaicb **)&lookups[i], 1, &timeout);
+        }
+    }
+
+    // Publish the results of all lookups finished so far
+    pthread_mutex_lock(&context->resolver_lock);
+    for (size_t r = 0; r < context->resolver.count; r++) {
+        dns_record *record = context->resolver.records[r];
+        if (!record->pending) continue;
+
+        int status = gai_error(&record->lookup);
+        if (status == EAI_INPROGRESS) continue;
+        record->pending = false;
+        if (status == 0 && record->lookup.ar_result != NULL) {
+            if (record->addresses != NULL) freeaddrinfo(record->addresses);
+            record->addresses = record->lookup.ar_result;
+            record->expires = monotonic_ms() + DNS_TTL;
+            record->generation++;
+        }
+        else {
+            // Keep addresses previously resolved, if any, for a while longer
+            record->expires = monotonic_ms() + DNS_NEGATIVE_TTL;
+        }
+    }
+    pthread_mutex_unlock(&context->resolver_lock);
+    free(lookups);
+    free(started);
+}
+
+/**
+ * Find the record of a hostname in the resolver cache.
+ * 
+ * @param hostname hostname or IP address
+ * @return the record, NULL if the hostname has not been seen before
+ */
+static dns_record *find_dns_record(char *hostname) {
+    for (size_t i = 0; i < context->resolver.count; i++) {
+        if (strcasecmp(context->resolver.records[i]->hostname, hostname) == 0)
+            return context->resolver.records[i];
+    }
+
+    return NULL;
+}
+
+/**
+ * Add the record of a hostname seen for the first time to the resolver cache,
+ * with resolver_lock held.
+ * 
+ * @param hostname hostname or IP address
+ * @return the record, NULL if out of memory
+ */
+static dns_record *create_dns_record(char *hostname) {
+    dns_cache *cache = &context->resolver;
+    if (cache->count == cache->capacity) {
+        size_t capacity = cache->capacity == 0 ? 16 : cache->capacity * 2;
+        dns_record **records = realloc(cache->records,
+                                       capacity * sizeof(dns_record *));
+        if (records == NULL) return NULL;
+        cache->records = records;
+        cache->capacity = capacity;
+    }
+    dns_record *record = calloc(1, sizeof(dns_record));
+    char *copy = strdup(hostname);
+    if (record == NULL || copy == NULL) {
+        free(record);
+        free(copy);
+        return NULL;
+    }
+    record->hostname = copy;
+    cache->records[cache->count++] = record;
+
+    return record;
+}
+
+/**
+ * Fill in the address of the current Gopher server, taken from its own copy
+ * of the addresses of its hostname. The address is only chosen again when
+ * the hostname has been resolved again since the previous connection, or
+ * once RACE_BACKOFF has passed after a failed race. Of several addresses, the
+ * one connected first in a race is chosen, which the caller runs.
+ * 
+ * @param race race to be run, with no address if none is needed (output)
+ * @return whether the server has an address
+ */
+static bool server_address(address_race *race) {
+    race->count = 0;
+    long long now = monotonic_ms();
+    if (now >= current->candidates_expire && !server_candidates(now))
+        return false;
+    if (current->addr_len != 0
+            && (current->rerace == 0 || now < current->rerace))
+        return true;
+
+    *race = current->candidates;
+    current->addr = race->addrs[0];
+    current->addr_len = race->lengths[0];
+    current->rerace = 0;
+    if (race->count == 1) race->count = 0;
+    return true;
+}
+
+/**
+ * Copy the addresses of the current Gopher server from the resolver cache,
+ * which is shared by all worker threads, once its own copy has expired. The
+ * copy is kept as long as the record in the cache, or for DNS_RECHECK while
+ * the record is refreshed in the background.
+ * 
+ * @param now monotonic time in milliseconds
+ * @return whether the server has an address
+ */
+static bool server_candidates(long long now) {
+    resolve_hosts(&current->hostname, 1);
+    pthread_mutex_lock(&context->resolver_lock);
+    dns_record *record = find_dns_record(current->hostname);
+    if (record == NULL || record->addresses == NULL) {
+        pthread_mutex_unlock(&context->resolver_lock);
+        return false;
+    }
+    if (record->generation != current->generation) {
+        race_prepare(&current->candidates, record->addresses, current->port);
+        current->generation = record->generation;
+        current->addr_len = 0;
+    }
+    current->candidates_expire = record->expires > now ? record->expires
+                                                       : now + DNS_RECHECK;
+    pthread_mutex_unlock(&context->resolver_lock);
+
+    return true;
+}
+
+/**
+ * Copy a resolved IPv4/IPv6 address and assign it a port.
+ * 
+ * @param dest destination of the address
+ * @param addr address resolved by getaddrinfo()
+ * @param port port number in host byte order
+ * @return length of the address
+ */
+static socklen_t set_address(struct sockaddr_storage *dest,
+                             struct addrinfo *addr, int port) {
+    memset(dest, 0, sizeof(struct sockaddr_storage));
+    memcpy(dest, addr->ai_addr, addr->ai_addrlen);
+    if (dest->ss_family == AF_INET6)
+        ((struct sockaddr_in6 *)dest)->sin6_port = htons(port);
+    else
+        ((struct sockaddr_in *)dest)->sin_port = htons(port);
+    return addr->ai_addrlen;
+}
+
+/**
+ * @param a first address
+ * @param b second address
+ * @return whether both addresses have the same IP address and port
+ */
+static bool same_address(struct sockaddr_storage *a, struct sockaddr *b) {
+    if (a->ss_family != b->sa_family) return false;
+    if (a->ss_family == AF_INET6) {
+        struct sockaddr_in6 *x = (struct sockaddr_in6 *)a;
+        struct sockaddr_in6 *y = (struct sockaddr_in6 *)b;
+        return x->sin6_port == y->sin6_port && memcmp(&x->sin6_addr,
+                &y->sin6_addr, sizeof(x->sin6_addr)) == 0;
+    }
+    struct sockaddr_in *x = (struct sockaddr_in *)a;
+    struct sockaddr_in *y = (struct sockaddr_in *)b;
+    return x->sin_port == y->sin_port && x->sin_addr.s_addr == y->sin_addr.s_addr;
+}
+
+/**
+ * Free the resolver cache once the context is destroyed. A record whose
+ * lookup cannot be cancelled is left to the resolver, which may still write
+ * to it.
+ */
+static void release_dns_cache(void) {
+    for (size_t i = 0; i < context->resolver.count; i++) {
+        dns_record *record = context->resolver.records[i];
+        if (record->pending && gai_cancel(&record->lookup) != EAI_CANCELED
+                && gai_error(&record->lookup) == EAI_INPROGRESS)
+            continue;
+        if (record->pending && record->lookup.ar_result != NULL)
+            freeaddrinfo(record->lookup.ar_result);
+        if (record->addresses != NULL) freeaddrinfo(record->addresses);
+        free(record->hostname);
+        free(record);
+    }
+    free(context->resolver.records);
+}
+
+/**
+ * Map the on-disk index written by a previous crawl into memory. A missing or
+ * invalid index is disregarded, so that the server is crawled from scratch.
+ * 
+ * @param path pathname of the on-disk index
+ */
+static void load_index(char *path) {
+    int index_fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (index_fd == -1) return;
+    struct stat st;
+    if (fstat(index_fd, &st) == -1
+            || (size_t)st.st_size < sizeof(index_header)) {
+        close(index_fd);
+        return;
+    }
+    char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, index_fd, 0);
+    close(index_fd);
+    if (map == MAP_FAILED) return;
+
+    saved_index *index = &current->last_crawl;
+    index->map = map;
+    index->map_size = st.st_size;
+    index->header = (index_header *)map;
+    if (!validate_index(index)) {
+        log_message(LOG_ERROR, stderr, "Error: Invalid index %s ignored\n",
+                    path);
+        release_index();
+        return;
+    }
+
+    // Look up the records by type and record string
+    size_t capacity = 16;
+    while (capacity < (size_t)index->header->num_of_records * 2) capacity *= 2;
+    index->slots = calloc(capacity, sizeof(uint32_t));
+    if (index->slots == NULL) {
+        memory_failed();
+        release_index();
+        return;
+    }
+    index->capacity = capacity;
+    for (uint32_t i = 0; i < index->header->num_of_records; i++) {
+        index_record *r = &index->records[i];
+        size_t slot = hash_item(r->item_type, index->strings + r->record)
+                      & (capacity - 1);
+        while (index->slots[slot] != 0) slot = (slot + 1) & (capacity - 1);
+        index->slots[slot] = i + 1;
+    }
+}
+
+/**
+ * Check that every offset in a mapped index lies within the file, so that a
+ * truncated or corrupt index is never dereferenced out of bounds.
+ * 
+ * @param index mapped index with its header
+ * @return whether the index is valid
+ */
+static bool validate_index(saved_index *index) {
+    index_header *header = index->header;
+    if (memcmp(header->magic, INDEX_MAGIC, sizeof(header->magic)) != 0)
+        return false;
+
+    uint64_t records_size = (uint64_t)header->num_of_records
+                            * sizeof(index_record);
+    uint64_t links_size = (uint64_t)header->num_of_links * sizeof(uint32_t);
+    uint64_t size = sizeof(index_header) + records_size + links_size;
+    if (header->strings_size == 0
+            || size + header->strings_size != index->map_size)
+        return false;
+    index->records = (index_record *)(index->map + sizeof(index_header));
+    index->links = (uint32_t *)(index->map + sizeof(index_header)
+                                + records_size);
+    index->strings = index->map + size;
+    if (index->strings[header->strings_size - 1] != '\0') return false;
+
+    for (uint32_t i = 0; i < header->num_of_records; i++) {
+        index_record *r = &index->records[i];
+        if (r->record >= header->strings_size || r->item_type >= NUM_OF_TYPES
+                || r->first_link > header->num_of_links
+                || r->num_of_links > header->num_of_links - r->first_link)
+            return false;
+    }
+    for (uint32_t i = 0; i < header->num_of_links; i++) {
+        if (index->links[i] >= header->num_of_records) return false;
+    }
+
+    return true;
+}
+
+/**
+ * Look up an item in the index of the previous crawl.
+ * 
+ * @param item_type type of the item
+ * @param record pointer to the record string
+ * @return record of the item, NULL if not indexed previously
+ */
+static index_record *find_saved(int item_type, char *record) {
+    saved_index *index = &current->last_crawl;
+    if (index->slots == NULL) return NULL;
+
+    size_t mask = index->capacity - 1;
+    size_t slot = hash_item(item_type, record) & mask;
+    while (index->slots[slot] != 0) {
+        index_record *r = &index->records[index->slots[slot] - 1];
+        if ((int)r->item_type == item_type
+                && strcmp(index->strings + r->record, record) == 0)
+            return r;
+        slot = (slot + 1) & mask;
+    }
+
+    return NULL;
+}
+
+/**
+ * Compare the item listed by a line of a directory index with the item listed
+ * at the same position in the previous crawl. On the first difference, the
+ * items matched so far are indexed and the comparison ends.
+ * 
+ * @param conn connection receiving a directory index listed in the last crawl
+ * @param line pointer to the fields of the directory index entry
+ * @return whether the line lists the same item, or none
+ */
+static bool match_line(connection *conn, menu_line *line) {
+    char *record;
+    int item_type = classify_line(line, conn->request, &record);
+    if (item_type == NOT_INDEXED) return true;
+
+    saved_index *index = &current->last_crawl;
+    if (conn->matched < conn->saved->num_of_links) {
+        uint32_t link = index->links[conn->saved->first_link + conn->matched];
+        index_record *r = &index->records[link];
+        if (r->item_type == (uint32_t)item_type
+                && strcmp(index->strings + r->record, record) == 0) {
+            conn->matched++;
+            return true;
+        }
+    }
+    index_matched(conn);
+    return false;
+}
+
+/**
+ * Index the items of a directory index which were listed as in the previous
+ * crawl, as if they had been parsed, and end the comparison.
+ * 
+ * @param conn connection receiving a directory index listed in the last crawl
+ */
+static void index_matched(connection *conn) {
+    saved_index *index = &current->last_crawl;
+    for (uint32_t i = 0; i < conn->matched; i++) {
+        index_record *r = &index->records[index->links[conn->saved->first_link
+                                                       + i]];
+        size_t child = index_item(r->item_type, index->strings + r->record);
+        if (child != ROOT && options->index_path != NULL)
+            log_link(conn->item, child);
+    }
+    conn->saved = NULL;
+}
+
+/**
+ * Index the items listed by an unchanged directory in the previous crawl. The
+ * sizes of files measured then are reused rather than measured again.
+ * 
+ * @param directory position of the unchanged directory
+ * @param saved record of the directory in the previous crawl
+ */
+static void replay_directory(size_t directory, index_record *saved) {
+    saved_index *index = &current->last_crawl;
+    current->parent = directory;
+    for (uint32_t i = 0; i < saved->num_of_links; i++) {
+        index_record *r = &index->records[index->links[saved->first_link + i]];
+        char *record = index->strings + r->record;
+        // Types no longer included are left out, as if the index were parsed
+        if ((r->item_type == SEARCH
+                && context->class_types[CLASS_SEARCH] != SEARCH)
+                || (r->item_type == LINK && !options->include_links))
+            continue;
+        size_t child = find_item(r->item_type, record);
+        if (child == ROOT) {
+            bool known = (r->item_type == TEXT || r->item_type == BINARY)
+                         && (r->size >= 0 || r->size == SIZE_TOO_LARGE);
+            child = add_item(r->item_type, record,
+                             known ? r->size : SIZE_PENDING);
+            if (child == ROOT) return;
+            if (known) current->store.checked[child] = r->checked;
+            // The content hashed then is that of the file reused
+            if (known && r->size >= 0 && r->hash != 0) {
+                current->store.hashes[child] = r->hash;
+                log_checkpoint(CHECKPOINT_HASH, child, (int64_t)r->hash);
+            }
+            if (current->store.sizes[child] == SIZE_TOO_LARGE)
+                index_item(TOO_LARGE, current->store.records[child]);
+        }
+        if (options->index_path != NULL) log_link(directory, child);
+    }
+}
+
+/**
+ * Record that a directory index lists an item, for the on-disk index.
+ * 
+ * @param parent directory listing the item
+ * @param child item listed
+ */
+static void log_link(size_t parent, size_t child) {
+    link_log *links = &current->links;
+    if (links->count == links->capacity) {
+        size_t capacity = links->capacity > 0 ? links->capacity * 2 : 1024;
+        child_link *grown = realloc(links->links,
+                                    capacity * sizeof(child_link));
+        if (grown == NULL) {
+            memory_failed();
+            return;
+        }
+        links->links = grown;
+        links->capacity = capacity;
+    }
+    links->links[links->count].parent = parent;
+    links->links[links->count].child = child;
+    links->count++;
+}
+
+/**
+ * Write the on-disk index of the crawl: the records of all indexed items in
+ * the order indexed (the root directory first), the items listed by every
+ * directory grouped by directory, and the record strings. The index is written to a temporary
+ * file which then replaces the previous index, so a failed write never
+ * leaves a truncated index behind.
+ * 
+ * @param path pathname of the on-disk index
+ */
+static void save_index(char *path) {
+    entry_store *store = &current->store;
+    link_log *links = &current->links;
+    index_header header;
+    memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+    header.num_of_records = store->count;
+    header.num_of_links = links->count;
+    header.strings_size = 0;
+    header.created = time(NULL);
+
+    size_t count = store->count;
+    index_record *records = calloc(count, sizeof(index_record));
+    uint32_t *children = malloc((links->count + 1) * sizeof(uint32_t));
+    if (records == NULL || children == NULL) {
+        memory_failed();
+        free(records);
+        free(children);
+        return;
+    }
+    for (size_t i = 0; i < count; i++) {
+        index_record *r = &records[i];
+        r->hash = store->hashes[i];
+        r->size = store->sizes[i];
+        r->checked = store->checked[i];
+        r->record = header.strings_size;
+        r->item_type = store->types[i];
+        header.strings_size += strlen(store->records[i]) + 1;
+    }
+
+    // Group the links by directory, keeping the order of each directory index
+    for (size_t i = 0; i < links->count; i++)
+        records[links->links[i].parent].num_of_links++;
+    uint32_t position = 0;
+    for (size_t i = 0; i < count; i++) {
+        records[i].first_link = position;
+        position += records[i].num_of_links;
+        records[i].num_of_links = 0;
+    }
+    for (size_t i = 0; i < links->count; i++) {
+        index_record *r = &records[links->links[i].parent];
+        children[r->first_link + r->num_of_links++] = links->links[i].child;
+    }
+
+    size_t length = strlen(path);
+    char temporary[length + 5];
+    memcpy(temporary, path, length);
+    memcpy(temporary + length, ".tmp", 5);
+    FILE *file = fopen(temporary, "wb");
+    bool written = file != NULL;
+    if (written) {
+        written = fwrite(&header, sizeof(header), 1, file) == 1
+            && fwrite(records, sizeof(index_record), count, file) == count
+            && fwrite(children, sizeof(uint32_t), links->count, file)
+               == links->count;
+        for (size_t i = 0; written && i < count; i++)
+            written = fwrite(store->records[i], strlen(store->records[i]) + 1,
+                             1, file) == 1;
+        written = fclose(file) == 0 && written;
+    }
+    if (!written || rename(temporary, path) == -1) {
+        log_message(LOG_ERROR, stderr, "Error: Unable to write index %s\n",
+                    path);
+        unlink(temporary);
+    }
+
+    free(records);
+    free(children);
+}
+
+/**
+ * Unmap the index of the previous crawl and release the links recorded.
+ */
+static void release_index(void) {
+    saved_index *last_crawl = &current->last_crawl;
+    if (last_crawl->map != NULL) munmap(last_crawl->map, last_crawl->map_size);
+    free(last_crawl->slots);
+    memset(&current->last_crawl, 0, sizeof(saved_index));
+    free(current->links.links);
+    current->links.links = NULL;
+    current->links.count = 0;
+    current->links.capacity = 0;
+}
+
+/**
+ * Start logging the progress of the crawl to an append-only checkpoint log.
+ * When resuming, the items, directories and file sizes recorded by the log
+ * are restored first, and only the directories and files not completed yet
+ * remain in the frontier queues. Otherwise, the log is started afresh.
+ * 
+ * @param path pathname of the checkpoint log
+ * @param resume whether to resume the crawl recorded by the log
+ * @return false if the crawl could not be resumed
+ */
+static bool open_checkpoint(char *path, bool resume) {
+    checkpoint_log *checkpoint = &current->checkpoint;
+    if (resume && !restore_checkpoint(path)) {
+        log_message(LOG_FATAL, stderr, "Error: Unable to resume from %s\n",
+                    path);
+        return false;
+    }
+
+    int flags = O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC;
+    checkpoint->fd = open(path, resume ? flags : flags | O_TRUNC, 0644);
+    if (checkpoint->fd == -1) {
+        log_message(LOG_ERROR, stderr, "Error: Unable to open checkpoint %s\n",
+                    path);
+        return true;
+    }
+    checkpoint->next = monotonic_ms() + CHECKPOINT_INTERVAL;
+    if (resume) return true;
+
+    // Name the server so that a log is never resumed against another one
+    if (write(checkpoint->fd, CHECKPOINT_MAGIC, strlen(CHECKPOINT_MAGIC)) == -1)
+        log_message(LOG_ERROR, stderr, "Error: Unable to write checkpoint\n");
+    char server[strlen(current->hostname) + 16];
+    snprintf(server, sizeof(server), "%s\t%d", current->hostname,
+             current->port);
+    append_checkpoint(CHECKPOINT_SERVER, DIRECTORY, server, 0);
+
+    return true;
+}
+
+/**
+ * Restore the progress of a crawl from its checkpoint log. The records are
+ * replayed in the order logged, so the items keep their positions in the
+ * entry store. A record cut short by the interruption ends the log and is
+ * discarded.
+ * 
+ * @param path pathname of the checkpoint log
+ * @return whether the log was restored
+ */
+static bool restore_checkpoint(char *path) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) return false;
+    char magic[8];
+    if (fread(magic, sizeof(magic), 1, file) != 1
+            || memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) != 0) {
+        fclose(file);
+        return false;
+    }
+
+    // Items restored are not logged again
+    current->restoring = true;
+    char server[strlen(current->hostname) + 16];
+    snprintf(server, sizeof(server), "%s\t%d", current->hostname,
+             current->port);
+    bool restored = false;
+    size_t count = 0;
+    char *record = NULL;
+    size_t capacity = 0;
+    checkpoint_record header;
+    long valid = ftell(file);
+    while (fread(&header, sizeof(header), 1, file) == 1) {
+        if (header.length + 1 > capacity) {
+            char *grown = realloc(record, header.length + 1);
+            if (grown == NULL) {
+                memory_failed();
+                restored = false;
+                break;
+            }
+            record = grown;
+            capacity = header.length + 1;
+        }
+        if (fread(record, 1, header.length, file) != header.length) break;
+        record[header.length] = '\0';
+        valid = ftell(file);
+
+        if (header.kind == CHECKPOINT_SERVER) {
+            restored = strcmp(record, server) == 0;
+            if (!restored) break;
+        }
+        else if (!restored) break;
+        else if (header.kind == CHECKPOINT_ITEM
+                && header.item_type < NUM_OF_TYPES) {
+            if (find_item(header.item_type, record) == ROOT) {
+                size_t item = add_item(header.item_type, record,
+                                       SIZE_PENDING);
+                if (item == ROOT) {
+                    restored = false;
+                    break;
+                }
+                current->store.depths[item] = (uint32_t)header.value;
+                count++;
+            }
+        }
+        else if (header.kind == CHECKPOINT_DONE) {
+            size_t item = header.length == 0 ? ROOT
+                          : find_item(DIRECTORY, record);
+            if (item != ROOT || header.length == 0) {
+                current->store.checked[item] = header.value;
+                output_item(item, OUTPUT_REUSED, -1, -1);
+            }
+        }
+        else if (header.kind == CHECKPOINT_SIZE) {
+            size_t item = find_item(header.item_type, record);
+            if (item != ROOT) {
+                current->store.sizes[item] = header.value;
+                tally_size(item);
+                output_item(item, header.value == SIZE_TOO_LARGE
+                            ? OUTPUT_TOO_LARGE : OUTPUT_REUSED,
+                            header.value < 0 ? -1 : header.value, -1);
+            }
+        }
+        else if (header.kind == CHECKPOINT_HASH) {
+            size_t item = find_item(header.item_type, record);
+            if (item != ROOT) current->store.hashes[item] = header.value;
+        }
+    }
+    current->restoring = false;
+    free(record);
+    fclose(file);
+    if (!restored) return false;
+
+    // Discard a record cut short so that the next records can be appended
+    if (truncate(path, valid) == -1) return false;
+
+    // Drop the directories and files completed before the interruption
+    filter_frontier(&current->queue, JOB_INDEX);
+    filter_frontier(&current->files, JOB_SIZE);
+    log_message(LOG_INFO, stdout, "Resumed crawl with %zu items indexed, "
+                "%zu directories and %zu files pending\n", count,
+                current->queue.tail - current->queue.head,
+                current->files.tail - current->files.head);
+
+    return true;
+}
+
+/**
+ * Remove the directories fetched or files measured from a frontier queue,
+ * keeping the order of the rest.
+ * 
+ * @param f frontier queue
+ * @param job JOB_INDEX for the directory queue, JOB_SIZE for the file queue
+ */
+static void filter_frontier(frontier *f, int job) {
+    size_t tail = f->head;
+    for (size_t i = f->head; i < f->tail; i++) {
+        size_t item = f->items[i];
+        bool complete = job == JOB_INDEX
+                ? current->store.checked[item] != 0
+                : current->store.sizes[item] != SIZE_PENDING;
+        if (!complete) f->items[tail++] = item;
+    }
+    f->tail = tail;
+}
+
+/**
+ * Log an event of the crawl to the checkpoint log, if enabled.
+ * 
+ * @param kind CHECKPOINT_ITEM, CHECKPOINT_DONE, CHECKPOINT_SIZE, etc.
+ * @param item item concerned
+ * @param value size or content hash of the file, or time at which the
+ *              directory was fetched
+ */
+static void log_checkpoint(int kind, size_t item, int64_t value) {
+    entry_store *store = &current->store;
+    if (current->checkpoint.fd == -1) return;
+    append_checkpoint(kind, store->types[item], store->records[item], value);
+}
+
+/**
+ * Append a record to the checkpoint records waiting to be written.
+ * 
+ * @param kind kind of the record
+ * @param item_type type of the item
+ * @param record pointer to the record string
+ * @param value value of the record
+ */
+static void append_checkpoint(int kind, int item_type, char *record,
+                              int64_t value) {
+    checkpoint_log *checkpoint = &current->checkpoint;
+    checkpoint_record header = {kind, item_type, 0, strlen(record), value};
+    size_t length = sizeof(header) + header.length;
+    if (checkpoint->length + length > checkpoint->capacity) {
+        size_t capacity = checkpoint->capacity > 0 ? checkpoint->capacity
+                                                  : BUFFER_SIZE;
+        while (capacity < checkpoint->length + length) capacity *= 2;
+        char *data = realloc(checkpoint->data, capacity);
+        if (data == NULL) {
+            memory_failed();
+            return;
+        }
+        checkpoint->data = data;
+        checkpoint->capacity = capacity;
+    }
+    memcpy(checkpoint->data + checkpoint->length, &header, sizeof(header));
+    memcpy(checkpoint->data + checkpoint->length + sizeof(header), record,
+           header.length);
+    checkpoint->length += length;
+}
+
+/**
+ * Append the pending records to the checkpoint log.
+ * 
+ * @param sync whether to wait until the records are stored on disk
+ */
+static void flush_checkpoint(bool sync) {
+    checkpoint_log *checkpoint = &current->checkpoint;
+    size_t written = 0;
+    while (written < checkpoint->length) {
+        ssize_t bytes = write(checkpoint->fd, checkpoint->data + written,
+                              checkpoint->length - written);
+        if (bytes == -1 && errno == EINTR) continue;
+        if (bytes == -1) {
+            log_message(LOG_ERROR, stderr,
+                        "Error: Unable to write checkpoint\n");
+            break;
+        }
+        written += bytes;
+    }
+    checkpoint->length = 0;
+    if (sync) fdatasync(checkpoint->fd);
+    checkpoint->next = monotonic_ms() + CHECKPOINT_INTERVAL;
+}
+
+/**
+ * Write the remaining records and close the checkpoint log.
+ */
+static void close_checkpoint(void) {
+    if (current->checkpoint.fd == -1) return;
+    flush_checkpoint(true);
+    close(current->checkpoint.fd);
+    current->checkpoint.fd = -1;
+    free(current->checkpoint.data);
+    current->checkpoint.data = NULL;
+    current->checkpoint.capacity = 0;
+}
+
+/**
+ * Create the machine-readable output of the entries of the index, which are
+ * written out as their outcome is known.
+ * 
+ * @param path pathname of the output
+ */
+static void open_output(char *path) {
+    output_writer *output = &current->output;
+    output->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (output->fd == -1) {
+        log_message(LOG_ERROR, stderr, "Error: Unable to write output %s\n",
+                    path);
+        return;
+    }
+    output->data = malloc(OUTPUT_BUFFER);
+    if (output->data == NULL) {
+        close(output->fd);
+        output->fd = -1;
+        memory_failed();
+        return;
+    }
+    output->length = 0;
+    if (options->output_format == OUTPUT_BINARY) {
+        memcpy(output->data, OUTPUT_MAGIC, strlen(OUTPUT_MAGIC));
+        output->length = strlen(OUTPUT_MAGIC);
+    }
+}
+
+/**
+ * Output an indexed item of the server crawled. The request line of an
+ * invalid reference is output without its "\r\n".
+ * 
+ * @param item position of the item
+ * @param status OUTPUT_OK, OUTPUT_FAILED, etc.
+ * @param size size of the file or directory index, -1 if unknown
+ * @param latency_us time taken by the request, -1 if not requested
+ */
+static void output_item(size_t item, int status, int64_t size,
+                        long long latency_us) {
+    if (current->output.fd == -1 && context->callback == NULL) return;
+    output_entry(current->store.types[item], current->store.records[item],
+                 current->hostname, current->port, status, size, latency_us);
+}
+
+/**
+ * Append an entry to the output in the format chosen, writing the entries
+ * buffered so far first if there is no room for it.
+ * 
+ * @param item_type type of the entry
+ * @param selector selector of the entry
+ * @param host hostname of the server of the entry
+ * @param port port of the server of the entry
+ * @param status OUTPUT_OK, OUTPUT_FAILED, etc.
+ * @param size size in bytes, -1 if unknown
+ * @param latency_us time taken by the request, -1 if not requested
+ */
+static void output_entry(int item_type, char *selector, char *host, int port,
+                         int status, int64_t size, long long latency_us) {
+    static char *types[NUM_OF_TYPES] = {"directory", "text", "binary",
+                                        "error", "external", "timeout",
+                                        "too_large", "search", "link",
+                                        "connect_failed"};
+    static char *statuses[] = {"ok", "failed", "timeout", "too_large",
+                               "invalid", "reused", "indexed", "up", "down",
+                               "self", "skipped"};
+    output_writer *output = &current->output;
+    if (context->callback != NULL) {
+        gopher_entry entry = {types[item_type], "", host, port,
+                              statuses[status], size, latency_us};
+        size_t length = strcspn(selector, "\r\n");
+        char *line = strndup(selector, length);
+        if (line == NULL) memory_failed();
+        else {
+            entry.selector = line;
+            pthread_mutex_lock(&context->callback_lock);
+            context->callback(&entry, context->user_data);
+            pthread_mutex_unlock(&context->callback_lock);
+            free(line);
+        }
+    }
+    if (output->fd == -1) return;
+
+    // The selector and the hostname are at most one line of a directory
+    // index, so an entry, even with every byte escaped, fits in the buffer
+    size_t selector_length = strcspn(selector, "\r\n");
+    size_t host_length = strlen(host);
+    if (selector_length > UINT16_MAX) selector_length = UINT16_MAX;
+    if (host_length > UINT16_MAX) host_length = UINT16_MAX;
+    size_t room = 6 * (selector_length + host_length) + 256;
+    if (output->length + room > OUTPUT_BUFFER) flush_output();
+
+    char *dest = output->data + output->length;
+    if (options->output_format == OUTPUT_BINARY) {
+        output_record record = {item_type, status, port, selector_length,
+                                host_length, size, latency_us};
+        memcpy(dest, &record, sizeof(record));
+        memcpy(dest + sizeof(record), selector, selector_length);
+        memcpy(dest + sizeof(record) + selector_length, host, host_length);
+        output->length += sizeof(record) + selector_length + host_length;
+        return;
+    }
+
+    char *start = dest;
+    dest += sprintf(dest, "{\"type\":\"%s\",\"selector\":\"",
+                    types[item_type]);
+    dest += escape_json(dest, selector, selector_length);
+    dest += sprintf(dest, "\",\"host\":\"");
+    dest += escape_json(dest, host, host_length);
+    dest += sprintf(dest, "\",\"port\":%d,\"size\":", port);
+    dest += size < 0 ? sprintf(dest, "null")
+            : sprintf(dest, "%lld", (long long)size);
+    dest += sprintf(dest, ",\"latency_us\":");
+    dest += latency_us < 0 ? sprintf(dest, "null")
+            : sprintf(dest, "%lld", latency_us);
+    dest += sprintf(dest, ",\"status\":\"%s\"}\n", statuses[status]);
+    output->length += dest - start;
+}
+
+/**
+ * Copy a string into a JSON string literal, escaping quotes, backslashes and
+ * control characters.
+ * 
+ * @param dest pointer to the destination, with room for 6 bytes per byte
+ * @param str pointer to the string
+ * @param length number of bytes of the string
+ * @return number of bytes written
+ */
+static size_t escape_json(char *dest, char *str, size_t length) {
+    char *start = dest;
+    for (size_t i = 0; i < length; i++) {
+        unsigned char c = str[i];
+        if (c == '"' || c == '\\') {
+            *dest++ = '\\';
+            *dest++ = c;
+        }
+        else if (c < 0x20) dest += sprintf(dest, "\\u%04x", c);
+        else *dest++ = c;
+    }
+    return dest - start;
+}
+
+/**
+ * Write the entries buffered so far to the output.
+ */
+static void flush_output(void) {
+    output_writer *output = &current->output;
+    size_t written = 0;
+    while (written < output->length) {
+        ssize_t bytes = write(output->fd, output->data + written,
+                              output->length - written);
+        if (bytes == -1 && errno == EINTR) continue;
+        if (bytes == -1) {
+            log_message(LOG_ERROR, stderr, "Error: Unable to write output\n");
+            break;
+        }
+        written += bytes;
+    }
+    output->length = 0;
+}
+
+/**
+ * Write the remaining entries and close the output.
+ */
+static void close_output(void) {
+    output_writer *output = &current->output;
+    if (output->fd != -1) {
+        flush_output();
+        close(output->fd);
+        output->fd = -1;
+    }
+    free(output->data);
+    output->data = NULL;
+    free(current->output_path);
+    current->output_path = NULL;
+}
@@ -0,0 +1,97 @@
+#ifndef GOPHERINDEX_H
+#define GOPHERINDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Public constants: phases of a crawl, which have their own deadlines */
+#define GOPHER_PHASE_CRAWL 0     // Fetching directory indices
+#define GOPHER_PHASE_SIZE 1      // Evaluating file sizes
+#define GOPHER_PHASE_EXTERNAL 2  // Testing external servers
+#define GOPHER_NUM_OF_PHASES 3   // Number of phases
+
+/* Public constants: deadlines of a request, in gopher_options.timeouts */
+#define GOPHER_DEADLINE_CONNECT 0     // Establishing the connection
+#define GOPHER_DEADLINE_FIRST_BYTE 1  // First byte, once the request is sent
+#define GOPHER_DEADLINE_IDLE 2        // Every following packet
+#define GOPHER_DEADLINE_TRANSFER 3    // Rest of the response
+#define GOPHER_NUM_OF_DEADLINES 4     // Number of deadlines
+
+/* Public constants: verbosity levels of the log */
+#define GOPHER_LOG_FATAL 0  // Errors ending a crawl, always logged
+#define GOPHER_LOG_ERROR 1  // Issues with requests and responses
+#define GOPHER_LOG_INFO 2   // Requests sent and items indexed (default)
+#define GOPHER_LOG_DEBUG 3  // Completion and timing of every request
+
+/* Public constants: orders in which the items found are requested */
+#define GOPHER_ORDER_BREADTH 0  // Directories in the order found, then files
+#define GOPHER_ORDER_DEPTH 1    // Directory found last first, then files
+#define GOPHER_ORDER_FILES 2    // Files ahead of directories
+
+/* Public constants: formats of the machine-readable output */
+#define GOPHER_OUTPUT_JSONL 0   // One JSON object per line
+#define GOPHER_OUTPUT_BINARY 1  // Length-prefixed binary records
+
+#define GOPHER_DEFAULT_PORT 70  // Port of a Gopher server if omitted
+
+/* Options of a crawl, filled with the defaults by gopher_default_options().
+ * The pathnames are not copied and must outlive the context. */
+typedef struct gopher_options {
+    int concurrency;              // Maximum requests in flight per server
+    size_t cache_limit;           // Largest text file cached, in bytes
+    int num_of_threads;           // Servers crawled at once
+    int follow_external;          // Hops of external references followed
+    double rate_limit;            // Requests/s to a server, 0 if no limit
+    int max_retries;              // Retries of a failed connection
+    int timeouts[GOPHER_NUM_OF_PHASES][GOPHER_NUM_OF_DEADLINES];  // In ms
+    bool include_search;          // Whether search servers are indexed
+    bool include_links;           // Whether URL links are indexed
+    bool hash_files;              // Whether the content is hashed
+    size_t file_limit;            // Bytes of a file measured at most
+    long long size_budget;        // Bytes of files of all servers, 0 if none
+    int crawl_order;              // GOPHER_ORDER_BREADTH, DEPTH or FILES
+    int max_depth;                // Levels crawled below root, -1 if all
+    long long max_requests;       // Requests to a server, 0 if no limit
+    double time_budget;           // Seconds to crawl, 0 if no limit
+    const char *metrics_path;     // JSON file for the metrics, or NULL
+    const char *index_path;       // On-disk index of the crawl, or NULL
+    const char *checkpoint_path;  // Checkpoint log of the crawl, or NULL
+    bool resume;                  // Whether to resume the crawl
+    const char *listing_path;     // Listings streamed during crawl, or NULL
+    const char *output_path;      // Machine-readable output, or NULL
+    int output_format;            // GOPHER_OUTPUT_JSONL or BINARY
+    int verbosity;                // Most verbose level logged
+} gopher_options;
+
+/* Entry of the index, delivered once its outcome is known. The strings are
+ * those of the machine-readable output and only valid during the callback. */
+typedef struct gopher_entry {
+    const char *type;      // "directory", "text", "binary", "error", etc.
+    const char *selector;  // Selector, "" for the root or a server
+    const char *host;      // Hostname of the server of the entry
+    int port;              // Port of the server of the entry
+    const char *status;    // "ok", "failed", "timeout", "reused", etc.
+    int64_t size;          // Size in bytes, -1 if unknown
+    long long latency_us;  // Time taken by the request, -1 if not requested
+} gopher_entry;
+
+/* Receiver of the entries of a crawl. It is called by the worker threads,
+ * one entry at a time. */
+typedef void (*gopher_callback)(const gopher_entry *entry, void *user_data);
+
+/* Crawl of one or more servers, independent of any other in the process */
+typedef struct gopher_context gopher_context;
+
+void gopher_default_options(gopher_options *options);
+bool gopher_parse_timeout(gopher_options *options, const char *spec);
+bool gopher_parse_include(gopher_options *options, const char *spec);
+gopher_context *gopher_create(const gopher_options *options,
+                              gopher_callback callback, void *user_data);
+bool gopher_add_server(gopher_context *ctx, const char *hostname, int port);
+bool gopher_crawl(gopher_context *ctx);
+void gopher_print_reports(gopher_context *ctx, FILE *out);
+void gopher_destroy(gopher_context *ctx);
+
+#endif